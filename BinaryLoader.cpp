@@ -1,16 +1,18 @@
 #include "BinaryLoader.h"
+#include "FieldAllocator.h"
+
+// Number of records read between checks for load cancellation.
+#define RECORDS_PER_CHUNK 65536
 
 ///////////////////////////////////////////////////////////////////////////////
 template<typename T>
-void BinaryLoader::readXYZ(
+T* readField(
     const String& filename,
+    uint fieldIndex,
     size_t readStart, size_t readLength, int decimation,
-    Vector<Vector3f>* points, Vector<Vector4f>* colors,
-    size_t* numPoints,
-    Vector3f* pointmin,
-    Vector3f* pointmax,
-    Vector4f* rgbamin,
-    Vector4f* rgbamax) const
+    double* fmin,
+    double* fmax,
+    bool* cancel)
 {
     Vector3f point;
     Vector4f color(1.0f, 1.0f, 1.0f, 1.0f);
@@ -20,14 +22,17 @@ void BinaryLoader::readXYZ(
     size_t recordSize = sizeof(T)* numFields;
 
     FILE* fin = fopen(filename.c_str(), "rb");
+    if(fin == NULL)
+    {
+        ofwarn("BinaryPointsLoader::readField: could not open %1%", %filename);
+        return NULL;
+    }
 
     // How many records are in the file?
     fseek(fin, 0, SEEK_END);
     size_t endpos = ftell(fin);
     fseek(fin, 0, SEEK_SET);
     size_t numRecords = endpos / recordSize;
-    //size_t readStart = numRecords * readStartP / BINARY_POINTS_MAX_BATCHES;
-    //size_t readLength = numRecords * readLengthP / BINARY_POINTS_MAX_BATCHES;
 
     if(decimation <= 0) decimation = 1;
     if(readStart != 0)
@@ -44,168 +49,85 @@ void BinaryLoader::readXYZ(
     //ofmsg("BinaryPointsLoader: reading records %1% - %2% of %3% (decimation %4%) of %5%",
     //    %readStart % (readStart + readLength) % numRecords %decimation %filename);
 
-    // Read in data
-    T* buffer = (T*)malloc(recordSize * readLength / decimation);
-    if(buffer == NULL)
+    // Allocate the field data: only the column we read is kept. Records are
+    // read into a scratch buffer one chunk at a time.
+    size_t ne = readLength / decimation;
+    T* data = (T*)FieldAllocator::allocate(ne * sizeof(T));
+    T* chunk = (T*)malloc(recordSize * RECORDS_PER_CHUNK);
+    if(data == NULL || chunk == NULL)
     {
-        oferror("BinaryPointsLoader::readXYZ: could not allocate %1% bytes",
-            % (recordSize * readLength / decimation));
-        return;
+        oferror("BinaryPointsLoader::readField: could not allocate %1% bytes",
+            % (ne * sizeof(T)));
+        FieldAllocator::free(data);
+        free(chunk);
+        fclose(fin);
+        return NULL;
     }
 
-    size_t ne = readLength / decimation;
     srand(100);
-    // Read data
-    // If data is not decimated, read it in one go.
-    if(decimation == 1)
-    {
-        size_t size = fread(buffer, recordSize, readLength, fin);
-    }
-    else
+    // Read data. Data is read in chunks, so we can stop early if the load
+    // gets cancelled.
+    size_t i = 0;
+    while(i < ne)
     {
-        int j = 0;
-        for(int i = 0; i < ne; i++)
+        if(*cancel)
         {
-            // // Read one record
-            // size_t size = fread(&buffer[j], recordSize, 1, fin);
-            // // Skip ahead decimation - 1 records.
-            // fseek(fin, recordSize * (decimation - 1), SEEK_CUR);
-
-            // RANDOM DECIMATED READ
-            size_t recordoffset = rand() / (RAND_MAX / decimation + 1);
-            size_t offs = ((size_t)recordSize) * (i * (decimation)+recordoffset);
-            fseek(fin, (long)((readStart * recordSize) + offs), SEEK_SET);
-            size_t size = fread(&buffer[j], recordSize, 1, fin);
-
-            j += numFields;
+            fclose(fin);
+            free(chunk);
+            FieldAllocator::free(data);
+            return NULL;
         }
-    }
-
-    points->reserve(ne);
-    colors->reserve(ne);
 
-    size_t j = 0;
-    for(size_t i = 0; i < ne; i++)
-    {
-        point[0] = buffer[i * numFields];
-        point[1] = buffer[i * numFields + 1];
-        point[2] = buffer[i * numFields + 2];
-
-        color[0] = buffer[i * numFields + 3];
-        color[1] = buffer[i * numFields + 4];
-        color[2] = buffer[i * numFields + 5];
-        color[3] = buffer[i * numFields + 6];
-
-        points->push_back(point);
-        colors->push_back(color);
-
-        // Update data bounds and number of points
-        *numPoints = *numPoints + 1;
-        for(size_t j = 0; j < 4; j++)
+        size_t n = min((size_t)RECORDS_PER_CHUNK, ne - i);
+        // If data is not decimated, read it sequentially.
+        size_t read = 0;
+        if(decimation == 1)
         {
-            if(color[j] < (*rgbamin)[j]) (*rgbamin)[j] = color[j];
-            if(color[j] > (*rgbamax)[j]) (*rgbamax)[j] = color[j];
+            read = fread(chunk, recordSize, n, fin);
         }
-        for(size_t j = 0; j < 3; j++)
+        else
         {
-            if(point[j] < (*pointmin)[j]) (*pointmin)[j] = point[j];
-            if(point[j] > (*pointmax)[j]) (*pointmax)[j] = point[j];
+            for(size_t k = 0; k < n; k++)
+            {
+                // // Read one record
+                // size_t size = fread(&buffer[j], recordSize, 1, fin);
+                // // Skip ahead decimation - 1 records.
+                // fseek(fin, recordSize * (decimation - 1), SEEK_CUR);
+
+                // RANDOM DECIMATED READ
+                size_t recordoffset = rand() / (RAND_MAX / decimation + 1);
+                size_t offs = ((size_t)recordSize) * ((i + k) * (decimation)+recordoffset);
+                fseek(fin, (long)((readStart * recordSize) + offs), SEEK_SET);
+                read += fread(&chunk[k * numFields], recordSize, 1, fin);
+            }
         }
-    }
-
-    fclose(fin);
-    free(buffer);
-}
 
-///////////////////////////////////////////////////////////////////////////////
-template<typename T>
-T* readField(
-    const String& filename,
-    uint fieldIndex,
-    size_t readStart, size_t readLength, int decimation,
-    double* fmin,
-    double* fmax)
-{
-    Vector3f point;
-    Vector4f color(1.0f, 1.0f, 1.0f, 1.0f);
-
-    // Default record size = 7 doubles (X,Y,Z,R,G,B,A)
-    int numFields = 7;
-    size_t recordSize = sizeof(T)* numFields;
-
-    FILE* fin = fopen(filename.c_str(), "rb");
-
-    // How many records are in the file?
-    fseek(fin, 0, SEEK_END);
-    size_t endpos = ftell(fin);
-    fseek(fin, 0, SEEK_SET);
-    size_t numRecords = endpos / recordSize;
-
-    if(decimation <= 0) decimation = 1;
-    if(readStart != 0)
-    {
-        fseek(fin, (long)(readStart * recordSize), SEEK_SET);
-    }
-
-    // Adjust read length.
-    if(readLength == 0 || readStart + readLength > numRecords)
-    {
-        readLength = numRecords - readStart;
-    }
-
-    //ofmsg("BinaryPointsLoader: reading records %1% - %2% of %3% (decimation %4%) of %5%",
-    //    %readStart % (readStart + readLength) % numRecords %decimation %filename);
-
-    // Read in data
-    T* buffer = (T*)malloc(recordSize * readLength / decimation);
-    if(buffer == NULL)
-    {
-        oferror("BinaryPointsLoader::readXYZ: could not allocate %1% bytes",
-            % (recordSize * readLength / decimation));
-        return NULL;
-    }
-
-    size_t ne = readLength / decimation;
-    srand(100);
-    // Read data
-    // If data is not decimated, read it in one go.
-    if(decimation == 1)
-    {
-        size_t size = fread(buffer, recordSize, readLength, fin);
-    }
-    else
-    {
-        int j = 0;
-        for(int i = 0; i < ne; i++)
+        if(read != n)
         {
-            // // Read one record
-            // size_t size = fread(&buffer[j], recordSize, 1, fin);
-            // // Skip ahead decimation - 1 records.
-            // fseek(fin, recordSize * (decimation - 1), SEEK_CUR);
-
-            // RANDOM DECIMATED READ
-            size_t recordoffset = rand() / (RAND_MAX / decimation + 1);
-            size_t offs = ((size_t)recordSize) * (i * (decimation)+recordoffset);
-            fseek(fin, (long)((readStart * recordSize) + offs), SEEK_SET);
-            size_t size = fread(&buffer[j], recordSize, 1, fin);
-
-            j += numFields;
+            ofwarn("BinaryPointsLoader::readField: short read from %1% (%2% of %3% records)",
+                %filename %read %n);
+            fclose(fin);
+            free(chunk);
+            FieldAllocator::free(data);
+            return NULL;
         }
-    }
 
-    size_t j = 0;
-    for(size_t i = 0; i < ne; i++)
-    {
-        buffer[i] = buffer[i * numFields + fieldIndex];
+        for(size_t k = 0; k < n; k++)
+        {
+            T v = chunk[k * numFields + fieldIndex];
+            data[i + k] = v;
 
-        // Update data bounds and number of points
-        *fmin = *fmin < buffer[i] ? *fmin : buffer[i];
-        *fmax = *fmax > buffer[i] ? *fmax : buffer[i];
+            // Update data bounds
+            *fmin = *fmin < v ? *fmin : v;
+            *fmax = *fmax > v ? *fmax : v;
+        }
+        i += n;
     }
 
     fclose(fin);
+    free(chunk);
     
-    return buffer;
+    return data;
 }
 
 
@@ -218,50 +140,63 @@ public:
 
     void execute(WorkerTask::TaskInfo* ti)
     {
+        Dataset* ds = field->getDimension()->dataset;
+        if(field->cancelled)
+        {
+            ds->loadCancelled(field);
+            return;
+        }
+
         String fullpath;
-        if(DataManager::findFile(path, fullpath))
+        if(!DataManager::findFile(path, fullpath))
         {
-            // Parse csv data column into a float array.
-            int nrows = 0;
-            double fmin = field->getDimension()->floatRangeMin;
-            double fmax = field->getDimension()->floatRangeMax;
-            int index = field->getDimension()->index;
+            ofwarn("BinaryLoader: could not find %1%", %path);
+            ds->loadFailed(field);
+            return;
+        }
 
-            void* data = NULL;
+        // Parse csv data column into a float array.
+        int nrows = 0;
+        double fmin = field->getDimension()->floatRangeMin;
+        double fmax = field->getDimension()->floatRangeMax;
+        int index = field->getDimension()->index;
 
-            if(Dataset::useDoublePrecision())
-            {
-                data = readField<double>(fullpath, index, field->domain.start, field->domain.length, field->domain.decimation, &fmin, &fmax);
-            }
-            else
-            {
-                data = readField<float>(fullpath, index, field->domain.start, field->domain.length, field->domain.decimation, &fmin, &fmax);
-            }
+        void* data = NULL;
+
+        if(Dataset::useDoublePrecision())
+        {
+            data = readField<double>(fullpath, index, field->domain.start, field->domain.length, field->domain.decimation, &fmin, &fmax, &field->cancelled);
+        }
+        else
+        {
+            data = readField<float>(fullpath, index, field->domain.start, field->domain.length, field->domain.decimation, &fmin, &fmax, &field->cancelled);
+        }
 
-            field->getDimension()->floatRangeMin = fmin;
-            field->getDimension()->floatRangeMax = fmax;
+        // Cancelled or failed loads leave the field unloaded. Failed loads
+        // are not retried.
+        if(data == NULL)
+        {
+            if(field->cancelled) ds->loadCancelled(field);
+            else ds->loadFailed(field);
+            return;
+        }
 
-            field->lock.lock();
-            // Extend the field data memory and copy the new data into it.
-            size_t elemSize = field->getDimension()->getElementSize();
-            if(field->data == NULL)
-            {
-                field->data = (char*)data;
-            }
-            else
-            {
-                free(field->data);
-                field->data = (char*)data;
-            }
+        field->getDimension()->floatRangeMin = fmin;
+        field->getDimension()->floatRangeMax = fmax;
 
-            // Update field length
-            field->loaded = true;
-            field->stamp = otimestamp();
+        field->lock.lock();
+        // Replace the old field data, if any.
+        if(field->data != NULL) FieldAllocator::free(field->data);
+        field->data = (char*)data;
 
-            field->lock.unlock();
+        // Update field length
+        field->loaded = true;
+        field->dataChanged();
 
-            //ofmsg("Loading %1% finished", %field->getName());
-        }
+        field->lock.unlock();
+
+        ds->loadCompleted(field);
+        //ofmsg("Loading %1% finished", %field->getName());
     }
 };
 
@@ -269,14 +204,13 @@ public:
 BinaryLoader::BinaryLoader()
 {
     myNumRecords = 0;
-    myLoaderPool.start(4);
+    myLoadScheduler.start(4);
 }
 
 ///////////////////////////////////////////////////////////////////////////////
 BinaryLoader::~BinaryLoader()
 {
-    myLoaderPool.stop();
-
+    myLoadScheduler.stop();
 }
 
 ///////////////////////////////////////////////////////////////////////////////
@@ -291,7 +225,7 @@ void BinaryLoader::load(Field* f)
     LoadTask* task = new LoadTask();
     task->field = f;
     task->path = myFilename;
-    myLoaderPool.queue(task);
+    myLoadScheduler.queue(task, f);
 }
 
 ///////////////////////////////////////////////////////////////////////////////
@@ -325,87 +259,19 @@ size_t BinaryLoader::getNumRecords(Dataset* d)
 ///////////////////////////////////////////////////////////////////////////////
 bool BinaryLoader::getBounds(const Domain& d, float* bounds)
 {
-    String boundsBasename;
-    String boundsExtension;
-    String boundsPath;
-    StringUtils::splitFullFilename(myFilename, boundsBasename, boundsExtension, boundsPath);
-    String boundsFileName = ostr("%1%bounds/%2%.%3%-%4%-%5%.bounds", %boundsPath %boundsBasename %d.start %d.length %d.decimation);
-
-    size_t length = d.length;
-    size_t start = d.start;
-    int decimation = d.decimation;
-
-    // Try to read bounds from bounds cache
-    if(readBoundsFile(boundsFileName, bounds)) return true;
+    AutoLock al(myBoundsLock);
+    if(myBoundsIndex == NULL)
+    {
+        String path;
+        if(!DataManager::findFile(myFilename, path)) return false;
 
-    String path;
-    if(DataManager::findFile(myFilename, path)) {
-        Vector<Vector3f> points;
-        Vector<Vector4f> colors;
-        size_t numPoints = 0;
-        float maxf = numeric_limits<float>::max();
-        float minf = -numeric_limits<float>::max();
-        Vector4f rgbamin = Vector4f(maxf, maxf, maxf, maxf);
-        Vector4f rgbamax = Vector4f(minf, minf, minf, minf);
-        Vector3f pointmin = Vector3f(maxf, maxf, maxf);
-        Vector3f pointmax = Vector3f(minf, minf, minf);
-        if(Dataset::useDoublePrecision()) readXYZ<double>(path, start, length, decimation, &points, &colors, &numPoints, &pointmin, &pointmax, &rgbamin, &rgbamax);
-        else readXYZ<float>(path, start, length, decimation, &points, &colors, &numPoints, &pointmin, &pointmax, &rgbamin, &rgbamax);
-
-        // make sure path exists
-        String p = boundsPath + "bounds";
-        //ofmsg("Creating path %1%", %p);
-        DataManager::createPath(p);
-
-        FILE* bf = fopen(boundsFileName.c_str(), "w");
-        if(bf == NULL)
-        {
-            ofwarn("[BinaryLoader::getBounds] failed opening <%1%> for writing", %boundsFileName);
-            return false;
-        }
-        fprintf(bf, "%f, %f, %f, %f, %f, %f, %f, %f, %f, %f, %f, %f, %f, %f",
-            pointmin[0], pointmax[0],
-            pointmin[1], pointmax[1],
-            pointmin[2], pointmax[2],
-            rgbamin[0], rgbamax[0],
-            rgbamin[1], rgbamax[1],
-            rgbamin[2], rgbamax[2],
-            rgbamin[3], rgbamax[3]);
-        fclose(bf);
-
-        bounds[0] = pointmin[0]; bounds[1] = pointmax[0];
-        bounds[2] = pointmin[1]; bounds[3] = pointmax[1];
-        bounds[4] = pointmin[2]; bounds[5] = pointmax[2];
-        bounds[6] = rgbamin[0]; bounds[7] = rgbamax[0];
-        bounds[8] = rgbamin[1]; bounds[9] = rgbamax[1];
-        bounds[10] = rgbamin[2]; bounds[11] = rgbamax[2];
-        bounds[12] = rgbamin[3]; bounds[13] = rgbamax[3];
-
-        return true;
+        // The index is opened (or built) once, and used by all batches.
+        myBoundsIndex = new BoundsIndex();
+        size_t elemSize = Dataset::useDoublePrecision() ? sizeof(double) : sizeof(float);
+        myBoundsIndex->open(path, path + ".bidx", elemSize);
     }
-    return false;
-}
 
-///////////////////////////////////////////////////////////////////////////////
-bool BinaryLoader::readBoundsFile(const String& filename, float* bounds)
-{
-    String path;
-    if(DataManager::findFile(filename, path))
-    {
-        String boundsText = DataManager::readTextFile(path);
-        // Bounds text format:
-        // xmin, xmax, ymin, ymax, zmin, zmax, rmin, rmax, gmin, gmax, bmin, bmax, amin, amax
-        Vector<String> vals = StringUtils::split(boundsText, ",");
-        for(int i = 0; i < 14; i++)
-        {
-            StringUtils::trim(vals[i]);
-            bounds[i] = boost::lexical_cast<float>(vals[i]);
-        }
-        return true;
-    }
-    else
-    {
-        ofmsg("BinaryPointsReader::readBoundsFile bounds file not found %1% ", %filename);
-    }
-    return false;
+    // Bounds are computed on full resolution data, so they hold for any 
+    // decimation of the domain.
+    return myBoundsIndex->getBounds(d.start, d.length, bounds);
 }
@@ -3,6 +3,8 @@
 
 #include <omega.h>
 #include "Loader.h"
+#include "LoadScheduler.h"
+#include "BoundsIndex.h"
 
 using namespace omega;
 
@@ -17,28 +19,17 @@ public:
     virtual void load(Field* f);
     virtual size_t getNumRecords(Dataset* d);
     virtual bool getBounds(const Domain& d, float* bounds);
+    virtual String getSource() { return myFilename; }
 
     //virtual bool load(BatchDrawable* batch, const String& filename) = 0;
     //virtual bool getBounds(const String& filename, size_t readStart, size_t readLength, int decimation, float* bounds, int dimensions);
 
-private:
-    bool readBoundsFile(const String& filename, float* bounds);
-
-    template<typename T>
-    void readXYZ(
-        const String& filename,
-        size_t readStart, size_t readLength, int decimation,
-        Vector<Vector3f>* points, Vector<Vector4f>* colors,
-        size_t* numPoints,
-        Vector3f* pointmin,
-        Vector3f* pointmax,
-        Vector4f* rgbamin,
-        Vector4f* rgbamax) const;
-
 private:
     String myFilename;
     size_t myNumRecords;
-    WorkerPool myLoaderPool;
+    LoadScheduler myLoadScheduler;
+    Ref<BoundsIndex> myBoundsIndex;
+    Lock myBoundsLock;
 };
 
 #endif
\ No newline at end of file
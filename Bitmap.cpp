@@ -0,0 +1,406 @@
+#include "Bitmap.h"
+
+#include <algorithm>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+// Number of 64 bit words in a bit set container.
+#define BITSET_WORDS 1024
+
+///////////////////////////////////////////////////////////////////////////////
+static inline uint popcount(uint64_t w)
+{
+#ifdef _MSC_VER
+    return (uint)__popcnt64(w);
+#else
+    return (uint)__builtin_popcountll(w);
+#endif
+}
+
+///////////////////////////////////////////////////////////////////////////////
+static inline uint lowestBit(uint64_t w)
+{
+#ifdef _MSC_VER
+    unsigned long b;
+    _BitScanForward64(&b, w);
+    return (uint)b;
+#else
+    return (uint)__builtin_ctzll(w);
+#endif
+}
+
+///////////////////////////////////////////////////////////////////////////////
+Bitmap::Bitmap(uint64_t size):
+    mySize(size),
+    myCardinality(0)
+{
+}
+
+///////////////////////////////////////////////////////////////////////////////
+void Bitmap::add(Container& c)
+{
+    if(c.cardinality == 0) return;
+    myCardinality += c.cardinality;
+    myContainers.push_back(Container());
+    Container& dst = myContainers.back();
+    dst.key = c.key;
+    dst.cardinality = c.cardinality;
+    dst.values.swap(c.values);
+    dst.bits.swap(c.bits);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+void Bitmap::toBitset(const Container& c, uint64_t* words)
+{
+    if(c.isBitset())
+    {
+        memcpy(words, &c.bits[0], BITSET_WORDS * sizeof(uint64_t));
+        return;
+    }
+    memset(words, 0, BITSET_WORDS * sizeof(uint64_t));
+    for(size_t i = 0; i < c.values.size(); i++)
+    {
+        uint v = c.values[i];
+        words[v >> 6] |= (uint64_t)1 << (v & 63);
+    }
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Stores a bit set in c, as an array if it has few bits set.
+void Bitmap::fromBitset(Container& c, const uint64_t* words)
+{
+    uint card = 0;
+    for(int i = 0; i < BITSET_WORDS; i++) card += popcount(words[i]);
+    c.cardinality = card;
+    c.values.clear();
+    c.bits.clear();
+    if(card > ArrayMax)
+    {
+        c.bits.assign(words, words + BITSET_WORDS);
+        return;
+    }
+    c.values.reserve(card);
+    for(int i = 0; i < BITSET_WORDS; i++)
+    {
+        uint64_t w = words[i];
+        while(w != 0)
+        {
+            c.values.push_back((uint16_t)(i * 64 + lowestBit(w)));
+            w &= w - 1;
+        }
+    }
+}
+
+///////////////////////////////////////////////////////////////////////////////
+Bitmap* Bitmap::fromSorted(const uint* indices, uint len, uint64_t size)
+{
+    Bitmap* b = new Bitmap(size);
+    b->append(0, indices, len);
+    return b;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+void Bitmap::append(uint64_t start, const uint* local, uint len)
+{
+    uint i = 0;
+    while(i < len)
+    {
+        uint key = (uint)((start + local[i]) >> 16);
+        uint64_t keyEnd = ((uint64_t)key + 1) << 16;
+        uint end = i;
+        while(end < len && start + local[end] < keyEnd) end++;
+
+        // Indices of the same chunk can come from several appends.
+        if(myContainers.empty() || myContainers.back().key != key)
+        {
+            myContainers.push_back(Container());
+            myContainers.back().key = key;
+            myContainers.back().cardinality = 0;
+        }
+        Container& c = myContainers.back();
+        uint n = end - i;
+        if(!c.isBitset() && c.cardinality + n > ArrayMax)
+        {
+            c.bits.assign(BITSET_WORDS, 0);
+            for(size_t k = 0; k < c.values.size(); k++)
+            {
+                uint v = c.values[k];
+                c.bits[v >> 6] |= (uint64_t)1 << (v & 63);
+            }
+            c.values.clear();
+        }
+        for(uint k = i; k < end; k++)
+        {
+            uint v = (uint)((start + local[k]) & 0xffff);
+            if(c.isBitset()) c.bits[v >> 6] |= (uint64_t)1 << (v & 63);
+            else c.values.push_back((uint16_t)v);
+        }
+        c.cardinality += n;
+        myCardinality += n;
+        i = end;
+    }
+}
+
+///////////////////////////////////////////////////////////////////////////////
+void Bitmap::intersect(const Container& a, const Container& b, Container& out)
+{
+    out.key = a.key;
+    if(!a.isBitset() && !b.isBitset())
+    {
+        out.values.resize(min(a.values.size(), b.values.size()));
+        Vector<uint16_t>::iterator end = std::set_intersection(
+            a.values.begin(), a.values.end(), b.values.begin(), b.values.end(),
+            out.values.begin());
+        out.values.resize(end - out.values.begin());
+        out.cardinality = (uint)out.values.size();
+    }
+    else if(a.isBitset() != b.isBitset())
+    {
+        // Keep the array values that are set in the bit set.
+        const Container& arr = a.isBitset() ? b : a;
+        const Container& bs = a.isBitset() ? a : b;
+        out.values.reserve(arr.values.size());
+        for(size_t i = 0; i < arr.values.size(); i++)
+        {
+            uint v = arr.values[i];
+            if(bs.bits[v >> 6] & ((uint64_t)1 << (v & 63))) out.values.push_back((uint16_t)v);
+        }
+        out.cardinality = (uint)out.values.size();
+    }
+    else
+    {
+        uint64_t words[BITSET_WORDS];
+        for(int i = 0; i < BITSET_WORDS; i++) words[i] = a.bits[i] & b.bits[i];
+        fromBitset(out, words);
+    }
+}
+
+///////////////////////////////////////////////////////////////////////////////
+void Bitmap::unite(const Container& a, const Container& b, Container& out)
+{
+    out.key = a.key;
+    if(!a.isBitset() && !b.isBitset() && a.cardinality + b.cardinality <= ArrayMax)
+    {
+        out.values.resize(a.values.size() + b.values.size());
+        Vector<uint16_t>::iterator end = std::set_union(
+            a.values.begin(), a.values.end(), b.values.begin(), b.values.end(),
+            out.values.begin());
+        out.values.resize(end - out.values.begin());
+        out.cardinality = (uint)out.values.size();
+    }
+    else
+    {
+        uint64_t words[BITSET_WORDS];
+        uint64_t bwords[BITSET_WORDS];
+        toBitset(a, words);
+        toBitset(b, bwords);
+        for(int i = 0; i < BITSET_WORDS; i++) words[i] |= bwords[i];
+        fromBitset(out, words);
+    }
+}
+
+///////////////////////////////////////////////////////////////////////////////
+Bitmap* Bitmap::intersection(Bitmap* a, Bitmap* b)
+{
+    Bitmap* r = new Bitmap(max(a->mySize, b->mySize));
+    size_t i = 0;
+    size_t j = 0;
+    while(i < a->myContainers.size() && j < b->myContainers.size())
+    {
+        const Container& ca = a->myContainers[i];
+        const Container& cb = b->myContainers[j];
+        if(ca.key < cb.key) i++;
+        else if(cb.key < ca.key) j++;
+        else
+        {
+            Container c;
+            intersect(ca, cb, c);
+            r->add(c);
+            i++;
+            j++;
+        }
+    }
+    return r;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+Bitmap* Bitmap::unionOf(Bitmap* a, Bitmap* b)
+{
+    Bitmap* r = new Bitmap(max(a->mySize, b->mySize));
+    size_t i = 0;
+    size_t j = 0;
+    while(i < a->myContainers.size() || j < b->myContainers.size())
+    {
+        bool hasA = i < a->myContainers.size();
+        bool hasB = j < b->myContainers.size();
+        if(hasA && (!hasB || a->myContainers[i].key < b->myContainers[j].key))
+        {
+            Container c = a->myContainers[i++];
+            r->add(c);
+        }
+        else if(hasB && (!hasA || b->myContainers[j].key < a->myContainers[i].key))
+        {
+            Container c = b->myContainers[j++];
+            r->add(c);
+        }
+        else
+        {
+            Container c;
+            unite(a->myContainers[i++], b->myContainers[j++], c);
+            r->add(c);
+        }
+    }
+    return r;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+Bitmap* Bitmap::complement(Bitmap* a)
+{
+    Bitmap* r = new Bitmap(a->mySize);
+    uint numKeys = (uint)((a->mySize + 0xffff) >> 16);
+    size_t i = 0;
+    uint64_t words[BITSET_WORDS];
+    for(uint key = 0; key < numKeys; key++)
+    {
+        if(i < a->myContainers.size() && a->myContainers[i].key == key)
+        {
+            toBitset(a->myContainers[i++], words);
+            for(int w = 0; w < BITSET_WORDS; w++) words[w] = ~words[w];
+        }
+        else
+        {
+            memset(words, 0xff, sizeof(words));
+        }
+
+        // Clear the bits past the end of the domain.
+        uint64_t chunkEnd = a->mySize - ((uint64_t)key << 16);
+        if(chunkEnd < 0x10000)
+        {
+            uint w = (uint)(chunkEnd >> 6);
+            if(chunkEnd & 63) words[w++] &= ((uint64_t)1 << (chunkEnd & 63)) - 1;
+            for(; w < BITSET_WORDS; w++) words[w] = 0;
+        }
+
+        Container c;
+        c.key = key;
+        fromBitset(c, words);
+        r->add(c);
+    }
+    return r;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+bool Bitmap::contains(uint64_t index)
+{
+    uint key = (uint)(index >> 16);
+    uint16_t v = (uint16_t)(index & 0xffff);
+    for(size_t i = 0; i < myContainers.size(); i++)
+    {
+        const Container& c = myContainers[i];
+        if(c.key < key) continue;
+        if(c.key > key) return false;
+        if(c.isBitset()) return (c.bits[v >> 6] & ((uint64_t)1 << (v & 63))) != 0;
+        return std::binary_search(c.values.begin(), c.values.end(), v);
+    }
+    return false;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+void Bitmap::toIndices(uint* out)
+{
+    foreach(const Container& c, myContainers)
+    {
+        uint base = (uint)((uint64_t)c.key << 16);
+        if(c.isBitset())
+        {
+            for(int i = 0; i < BITSET_WORDS; i++)
+            {
+                uint64_t w = c.bits[i];
+                while(w != 0)
+                {
+                    *out++ = base + i * 64 + lowestBit(w);
+                    w &= w - 1;
+                }
+            }
+        }
+        else
+        {
+            for(size_t i = 0; i < c.values.size(); i++) *out++ = base + c.values[i];
+        }
+    }
+}
+
+///////////////////////////////////////////////////////////////////////////////
+uint Bitmap::toIndices(uint64_t start, uint64_t end, uint* out)
+{
+    uint n = 0;
+    foreach(const Container& c, myContainers)
+    {
+        uint64_t base = (uint64_t)c.key << 16;
+        if(base + 0x10000 <= start) continue;
+        if(base >= end) break;
+        if(c.isBitset())
+        {
+            for(int i = 0; i < BITSET_WORDS; i++)
+            {
+                uint64_t w = c.bits[i];
+                while(w != 0)
+                {
+                    uint64_t index = base + i * 64 + lowestBit(w);
+                    if(index >= start && index < end) out[n++] = (uint)(index - start);
+                    w &= w - 1;
+                }
+            }
+        }
+        else
+        {
+            for(size_t i = 0; i < c.values.size(); i++)
+            {
+                uint64_t index = base + c.values[i];
+                if(index >= start && index < end) out[n++] = (uint)(index - start);
+            }
+        }
+    }
+    return n;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+uint64_t Bitmap::getCardinality(uint64_t start, uint64_t end)
+{
+    uint64_t n = 0;
+    foreach(const Container& c, myContainers)
+    {
+        uint64_t base = (uint64_t)c.key << 16;
+        if(base + 0x10000 <= start) continue;
+        if(base >= end) break;
+        // Chunks entirely in the range are counted as a whole.
+        if(base >= start && base + 0x10000 <= end)
+        {
+            n += c.cardinality;
+            continue;
+        }
+        uint lo = base < start ? (uint)(start - base) : 0;
+        uint hi = (uint)(min(end - base, (uint64_t)0x10000));
+        if(c.isBitset())
+        {
+            for(uint v = lo; v < hi; v++) n += (c.bits[v >> 6] >> (v & 63)) & 1;
+        }
+        else
+        {
+            for(size_t i = 0; i < c.values.size(); i++) n += c.values[i] >= lo && c.values[i] < hi;
+        }
+    }
+    return n;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+size_t Bitmap::getMemorySize()
+{
+    size_t size = sizeof(Bitmap) + myContainers.size() * sizeof(Container);
+    foreach(const Container& c, myContainers)
+    {
+        size += c.values.size() * sizeof(uint16_t) + c.bits.size() * sizeof(uint64_t);
+    }
+    return size;
+}
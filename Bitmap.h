@@ -0,0 +1,84 @@
+#ifndef __BITMAP__
+#define __BITMAP__
+
+#include <omega.h>
+
+using namespace omega;
+
+///////////////////////////////////////////////////////////////////////////////
+//! Compressed set of element indices (roaring bitmap). Indices are split in
+//! chunks of 65536 by their high 16 bits. Each chunk stores its low 16 bits
+//! as a sorted array when it holds few indices, or as a 65536 bit set when
+//! it holds many. Sparse sets take about 2 bytes per index, dense sets about
+//! 1 bit per element.
+//! Chunk keys are 32 bits, so bitmaps index up to 2^48 elements. Index lists
+//! use 32 bit indices local to a segment of the domain plus a 64 bit segment
+//! start (i.e. the scan chunk or batch they belong to).
+//! Bitmaps are immutable once built: set operations return new bitmaps.
+class Bitmap : public ReferenceType
+{
+public:
+    //! Chunks holding more indices than this are stored as bit sets.
+    static const uint ArrayMax = 4096;
+
+public:
+    //! Creates an empty bitmap. size is the number of elements in the
+    //! indexed domain (used by complement).
+    Bitmap(uint64_t size);
+
+    //! Creates a bitmap from sorted indices.
+    static Bitmap* fromSorted(const uint* indices, uint len, uint64_t size);
+
+    static Bitmap* intersection(Bitmap* a, Bitmap* b);
+    static Bitmap* unionOf(Bitmap* a, Bitmap* b);
+    //! Returns the indices in [0, size) that are not in a.
+    static Bitmap* complement(Bitmap* a);
+
+    //! Adds the sorted indices start + local[i] while building a bitmap. They
+    //! must follow all indices already in the bitmap.
+    void append(uint64_t start, const uint* local, uint len);
+
+    uint64_t getSize() { return mySize; }
+    uint64_t getCardinality() { return myCardinality; }
+    //! Returns the number of indices in [start, end).
+    uint64_t getCardinality(uint64_t start, uint64_t end);
+    bool contains(uint64_t index);
+
+    //! Writes the indices in increasing order to out, that must hold
+    //! getCardinality() entries. The domain must have less than 2^32 
+    //! elements.
+    void toIndices(uint* out);
+    //! Writes the indices in [start, end) minus start in increasing order to
+    //! out, and returns their number.
+    uint toIndices(uint64_t start, uint64_t end, uint* out);
+
+    size_t getMemorySize();
+
+private:
+    struct Container
+    {
+        // High 16 bits of the indices in this chunk.
+        uint key;
+        uint cardinality;
+        // Low 16 bits of the indices, for array containers.
+        Vector<uint16_t> values;
+        // Bit set, for bit set containers.
+        Vector<uint64_t> bits;
+
+        bool isBitset() const { return !bits.empty(); }
+    };
+
+    void add(Container& c);
+
+    static void toBitset(const Container& c, uint64_t* words);
+    static void fromBitset(Container& c, const uint64_t* words);
+    static void intersect(const Container& a, const Container& b, Container& out);
+    static void unite(const Container& a, const Container& b, Container& out);
+
+private:
+    uint64_t mySize;
+    uint64_t myCardinality;
+    Vector<Container> myContainers;
+};
+
+#endif
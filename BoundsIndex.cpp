@@ -0,0 +1,328 @@
+#include "BoundsIndex.h"
+#include "ComputePool.h"
+
+#include <math.h>
+#include <sys/stat.h>
+#ifdef OMEGA_OS_WIN
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+#define BOUNDS_INDEX_MAGIC 0x58444942
+#define BOUNDS_INDEX_VERSION 2
+// Number of index blocks processed by each build chunk.
+#define BLOCKS_PER_CHUNK 256
+
+///////////////////////////////////////////////////////////////////////////////
+// Seeks to a 64 bit file offset.
+static void seek(FILE* f, uint64_t offset)
+{
+#ifdef OMEGA_OS_WIN
+    _fseeki64(f, offset, SEEK_SET);
+#else
+    fseeko(f, (off_t)offset, SEEK_SET);
+#endif
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Converts bounds to float, rounding outward so they still contain all the
+// values they were computed from.
+template<typename T> static float floatBelow(T v)
+{
+    float f = (float)v;
+    return f > v ? nextafterf(f, -numeric_limits<float>::infinity()) : f;
+}
+
+template<typename T> static float floatAbove(T v)
+{
+    float f = (float)v;
+    return f < v ? nextafterf(f, numeric_limits<float>::infinity()) : f;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// State shared by the chunks of an index build.
+struct BoundsBuild
+{
+    String source;
+    size_t elementSize;
+    size_t numRecords;
+    size_t numBlocks;
+    float* blocks;
+
+    Lock lock;
+    bool failed;
+};
+
+///////////////////////////////////////////////////////////////////////////////
+// Computes the bounds of index blocks. Each chunk streams a contiguous range
+// of the source file.
+class BoundsBuildTask : public ParallelTask
+{
+public:
+    BoundsBuild* build;
+
+    template<typename T> bool process(size_t firstBlock, size_t numBlocks)
+    {
+        FILE* fin = fopen(build->source.c_str(), "rb");
+        if(fin == NULL) return false;
+
+        const int nc = BoundsIndex::NumColumns;
+        const size_t recordSize = sizeof(T) * nc;
+        T* buffer = (T*)malloc(recordSize * BoundsIndex::BlockRecords);
+
+        seek(fin, (uint64_t)firstBlock * BoundsIndex::BlockRecords * recordSize);
+        for(size_t b = firstBlock; b < firstBlock + numBlocks; b++)
+        {
+            size_t start = b * BoundsIndex::BlockRecords;
+            size_t n = min((size_t)BoundsIndex::BlockRecords, build->numRecords - start);
+            if(fread(buffer, recordSize, n, fin) != n)
+            {
+                free(buffer);
+                fclose(fin);
+                return false;
+            }
+
+            float* bounds = &build->blocks[b * nc * 2];
+            for(int c = 0; c < nc; c++)
+            {
+                // NaN values are not part of the bounds. Columns with no
+                // other value get an empty range (min > max).
+                T vmin = numeric_limits<T>::max();
+                T vmax = -numeric_limits<T>::max();
+                for(size_t i = 0; i < n; i++)
+                {
+                    T v = buffer[i * nc + c];
+                    if(v != v) continue;
+                    vmin = vmin < v ? vmin : v;
+                    vmax = vmax > v ? vmax : v;
+                }
+                bounds[c * 2] = floatBelow(vmin);
+                bounds[c * 2 + 1] = floatAbove(vmax);
+            }
+        }
+        free(buffer);
+        fclose(fin);
+        return true;
+    }
+
+    void run(size_t chunk)
+    {
+        size_t first = chunk * BLOCKS_PER_CHUNK;
+        size_t n = min((size_t)BLOCKS_PER_CHUNK, build->numBlocks - first);
+        bool ok = build->elementSize == sizeof(double) ?
+            process<double>(first, n) : process<float>(first, n);
+
+        if(!ok)
+        {
+            build->lock.lock();
+            build->failed = true;
+            build->lock.unlock();
+        }
+    }
+};
+
+///////////////////////////////////////////////////////////////////////////////
+BoundsIndex::BoundsIndex():
+    myNumRecords(0),
+    myNumBlocks(0),
+    myBlocks(NULL),
+    myMapping(NULL),
+    myMappingSize(0)
+{
+}
+
+///////////////////////////////////////////////////////////////////////////////
+BoundsIndex::~BoundsIndex()
+{
+    close();
+}
+
+///////////////////////////////////////////////////////////////////////////////
+void BoundsIndex::close()
+{
+    if(myMapping != NULL)
+    {
+#ifdef OMEGA_OS_WIN
+        UnmapViewOfFile(myMapping);
+#else
+        munmap(myMapping, myMappingSize);
+#endif
+        myMapping = NULL;
+    }
+    myBlockData.clear();
+    myBlocks = NULL;
+    myNumRecords = 0;
+    myNumBlocks = 0;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+bool BoundsIndex::open(const String& source, const String& indexPath, size_t elementSize)
+{
+    close();
+
+    struct stat st;
+    if(stat(source.c_str(), &st) != 0)
+    {
+        ofwarn("[BoundsIndex::open] could not find %1%", %source);
+        return false;
+    }
+
+    Header h;
+    memset(&h, 0, sizeof(Header));
+    h.magic = BOUNDS_INDEX_MAGIC;
+    h.version = BOUNDS_INDEX_VERSION;
+    h.elementSize = (uint)elementSize;
+    h.blockRecords = BlockRecords;
+    h.sourceSize = (uint64_t)st.st_size;
+    h.sourceTime = (uint64_t)st.st_mtime;
+    h.numRecords = (uint64_t)st.st_size / (elementSize * NumColumns);
+
+    if(load(indexPath, h)) return true;
+
+    double t = otimestamp();
+    if(!build(source, elementSize)) return false;
+    ofmsg("[BoundsIndex::open] indexed %1% records of %2% in %3% seconds",
+        %myNumRecords %source %(otimestamp() - t));
+
+    save(indexPath, h);
+    return true;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+bool BoundsIndex::load(const String& indexPath, const Header& expected)
+{
+    size_t numBlocks = (size_t)((expected.numRecords + BlockRecords - 1) / BlockRecords);
+    size_t size = sizeof(Header) + numBlocks * NumColumns * 2 * sizeof(float);
+
+#ifdef OMEGA_OS_WIN
+    HANDLE file = CreateFileA(indexPath.c_str(), GENERIC_READ, FILE_SHARE_READ,
+        NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    if(file == INVALID_HANDLE_VALUE) return false;
+    LARGE_INTEGER fs;
+    GetFileSizeEx(file, &fs);
+    void* p = NULL;
+    if((size_t)fs.QuadPart == size)
+    {
+        HANDLE mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+        if(mapping != NULL)
+        {
+            p = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+            CloseHandle(mapping);
+        }
+    }
+    CloseHandle(file);
+    if(p == NULL) return false;
+#else
+    int fd = ::open(indexPath.c_str(), O_RDONLY);
+    if(fd < 0) return false;
+    struct stat st;
+    void* p = NULL;
+    if(fstat(fd, &st) == 0 && (size_t)st.st_size == size)
+    {
+        p = mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+        if(p == MAP_FAILED) p = NULL;
+    }
+    ::close(fd);
+    if(p == NULL) return false;
+#endif
+
+    myMapping = p;
+    myMappingSize = size;
+
+    // Discard indices built for a different version of the source.
+    if(memcmp(p, &expected, sizeof(Header)) != 0)
+    {
+        close();
+        return false;
+    }
+
+    myNumRecords = (size_t)expected.numRecords;
+    myNumBlocks = numBlocks;
+    myBlocks = (float*)((char*)p + sizeof(Header));
+    return true;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+bool BoundsIndex::build(const String& source, size_t elementSize)
+{
+    BoundsBuild b;
+    b.source = source;
+    b.elementSize = elementSize;
+    b.failed = false;
+
+    struct stat st;
+    stat(source.c_str(), &st);
+    b.numRecords = (size_t)st.st_size / (elementSize * NumColumns);
+    size_t numBlocks = (b.numRecords + BlockRecords - 1) / BlockRecords;
+    b.numBlocks = numBlocks;
+    myBlockData.resize(numBlocks * NumColumns * 2);
+    b.blocks = numBlocks > 0 ? &myBlockData[0] : NULL;
+
+    BoundsBuildTask task;
+    task.build = &b;
+    ComputePool::instance()->parallelFor(&task, (numBlocks + BLOCKS_PER_CHUNK - 1) / BLOCKS_PER_CHUNK);
+
+    if(b.failed)
+    {
+        ofwarn("[BoundsIndex::build] failed reading %1%", %source);
+        myBlockData.clear();
+        return false;
+    }
+
+    myNumRecords = b.numRecords;
+    myNumBlocks = numBlocks;
+    myBlocks = b.blocks;
+    return true;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+void BoundsIndex::save(const String& indexPath, const Header& header)
+{
+    // Write to a temporary file first, so a partially written index is never
+    // picked up.
+    String tmpPath = indexPath + ".tmp";
+    FILE* f = fopen(tmpPath.c_str(), "wb");
+    if(f == NULL)
+    {
+        ofwarn("[BoundsIndex::save] failed opening <%1%> for writing", %tmpPath);
+        return;
+    }
+    bool ok = fwrite(&header, sizeof(Header), 1, f) == 1;
+    if(myNumBlocks > 0)
+    {
+        ok &= fwrite(myBlocks, NumColumns * 2 * sizeof(float), myNumBlocks, f) == myNumBlocks;
+    }
+    fclose(f);
+
+    remove(indexPath.c_str());
+    if(!ok || rename(tmpPath.c_str(), indexPath.c_str()) != 0)
+    {
+        ofwarn("[BoundsIndex::save] failed writing <%1%>", %indexPath);
+        remove(tmpPath.c_str());
+    }
+}
+
+///////////////////////////////////////////////////////////////////////////////
+bool BoundsIndex::getBounds(size_t start, size_t length, float* bounds)
+{
+    if(myBlocks == NULL || start >= myNumRecords) return false;
+    if(length == 0 || start + length > myNumRecords) length = myNumRecords - start;
+
+    size_t first = start / BlockRecords;
+    size_t last = (start + length - 1) / BlockRecords;
+
+    memcpy(bounds, &myBlocks[first * NumColumns * 2], NumColumns * 2 * sizeof(float));
+    for(size_t b = first + 1; b <= last; b++)
+    {
+        const float* bb = &myBlocks[b * NumColumns * 2];
+        for(int c = 0; c < NumColumns * 2; c += 2)
+        {
+            bounds[c] = bounds[c] < bb[c] ? bounds[c] : bb[c];
+            bounds[c + 1] = bounds[c + 1] > bb[c + 1] ? bounds[c + 1] : bb[c + 1];
+        }
+    }
+    return true;
+}
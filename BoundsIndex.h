@@ -0,0 +1,69 @@
+#ifndef __BOUNDS_INDEX__
+#define __BOUNDS_INDEX__
+
+#include <omega.h>
+
+using namespace omega;
+
+///////////////////////////////////////////////////////////////////////////////
+//! Min/max bounds of every column of a binary point file, stored for fixed
+//! size blocks of records. The index is built by a parallel streaming pass
+//! over the source file and saved in a single index file, that is memory
+//! mapped when the source is opened again. The bounds of any record range
+//! are computed by merging the bounds of the blocks covering it. Bounds skip
+//! NaN values, and are rounded outward to float.
+class BoundsIndex : public ReferenceType
+{
+public:
+    //! Number of columns in a binary point record (X,Y,Z,R,G,B,A)
+    static const int NumColumns = 7;
+    //! Number of records in an index block.
+    static const uint BlockRecords = 4096;
+
+public:
+    BoundsIndex();
+    ~BoundsIndex();
+
+    //! Opens the index of source, building it if it does not exist or is
+    //! older than the source. Source records are made of elementSize bytes
+    //! values. The index is built on the compute pool.
+    bool open(const String& source, const String& indexPath, size_t elementSize);
+    void close();
+    bool isOpen() { return myBlocks != NULL; }
+
+    size_t getNumRecords() { return myNumRecords; }
+
+    //! Gets the bounds of records [start, start + length) as min,max pairs
+    //! for each column. Partially covered blocks are merged as a whole, so
+    //! bounds can be slightly larger than the actual range bounds.
+    bool getBounds(size_t start, size_t length, float* bounds);
+
+private:
+    struct Header
+    {
+        uint magic;
+        uint version;
+        uint elementSize;
+        uint blockRecords;
+        uint64_t sourceSize;
+        uint64_t sourceTime;
+        uint64_t numRecords;
+    };
+
+    bool load(const String& indexPath, const Header& expected);
+    bool build(const String& source, size_t elementSize);
+    void save(const String& indexPath, const Header& header);
+
+private:
+    size_t myNumRecords;
+    size_t myNumBlocks;
+    // Block bounds: NumColumns min,max pairs for each block
+    float* myBlocks;
+
+    // Index file mapping, or NULL if the blocks are in myBlockData.
+    void* myMapping;
+    size_t myMappingSize;
+    Vector<float> myBlockData;
+};
+
+#endif
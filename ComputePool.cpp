@@ -0,0 +1,120 @@
+#include "ComputePool.h"
+
+#ifdef OMEGA_OS_WIN
+#include <windows.h>
+#else
+#include <unistd.h>
+#endif
+
+ComputePool* ComputePool::mysInstance = NULL;
+
+///////////////////////////////////////////////////////////////////////////////
+static int getNumCores()
+{
+#ifdef OMEGA_OS_WIN
+    SYSTEM_INFO si;
+    GetSystemInfo(&si);
+    return (int)si.dwNumberOfProcessors;
+#else
+    long n = sysconf(_SC_NPROCESSORS_ONLN);
+    return n > 0 ? (int)n : 1;
+#endif
+}
+
+///////////////////////////////////////////////////////////////////////////////
+ComputePool* ComputePool::instance()
+{
+    if(mysInstance == NULL) mysInstance = new ComputePool();
+    return mysInstance;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+ComputePool::ComputePool():
+    myNumThreads(0),
+    myActiveJobs(0),
+    myPendingThreads(0)
+{
+    setThreads(getNumCores());
+}
+
+///////////////////////////////////////////////////////////////////////////////
+ComputePool::~ComputePool()
+{
+    myPool.stop();
+}
+
+///////////////////////////////////////////////////////////////////////////////
+void ComputePool::setThreads(int threads)
+{
+    if(threads < 1) threads = 1;
+    AutoLock al(myLock);
+    // Stopping the pool would drop the chunks of running loops.
+    if(myActiveJobs > 0)
+    {
+        myPendingThreads = threads;
+        return;
+    }
+    applyThreads(threads);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+void ComputePool::applyThreads(int threads)
+{
+    myPendingThreads = 0;
+    if(threads == myNumThreads) return;
+    if(myNumThreads > 0) myPool.stop();
+    myNumThreads = threads;
+    // The calling thread of parallelFor runs chunks too.
+    if(myNumThreads > 1) myPool.start(myNumThreads - 1);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+void ComputePool::Job::runChunks()
+{
+    while(true)
+    {
+        monitor.lock();
+        size_t chunk = next;
+        if(chunk < numChunks) next++;
+        monitor.unlock();
+        if(chunk >= numChunks) return;
+
+        task->run(chunk);
+
+        monitor.lock();
+        done++;
+        if(done == numChunks) monitor.notifyAll();
+        monitor.unlock();
+    }
+}
+
+///////////////////////////////////////////////////////////////////////////////
+void ComputePool::parallelFor(ParallelTask* task, size_t numChunks)
+{
+    if(numChunks == 0) return;
+
+    Ref<Job> job = new Job();
+    job->task = task;
+    job->numChunks = numChunks;
+    job->next = 0;
+    job->done = 0;
+
+    myLock.lock();
+    myActiveJobs++;
+    // Runners that start after all chunks are taken exit right away.
+    size_t runners = min((size_t)myNumThreads - 1, numChunks - 1);
+    for(size_t i = 0; i < runners; i++) myPool.queue(new JobRunner(job));
+    myLock.unlock();
+
+    job->runChunks();
+
+    // Wait for the chunks still running on pool threads.
+    job->monitor.lock();
+    while(job->done != numChunks) job->monitor.wait();
+    job->monitor.unlock();
+
+    // Apply thread count changes requested while loops were running.
+    AutoLock al(myLock);
+    myActiveJobs--;
+    if(myActiveJobs == 0 && myPendingThreads > 0) applyThreads(myPendingThreads);
+}
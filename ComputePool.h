@@ -0,0 +1,85 @@
+#ifndef __COMPUTE_POOL__
+#define __COMPUTE_POOL__
+
+#include <omega.h>
+#include "Monitor.h"
+
+using namespace omega;
+
+///////////////////////////////////////////////////////////////////////////////
+//! Body of a parallel loop run by ComputePool::parallelFor.
+class ParallelTask
+{
+public:
+    virtual ~ParallelTask() {}
+    //! Processes one chunk of the loop. Called concurrently for different
+    //! chunks.
+    virtual void run(size_t chunk) = 0;
+};
+
+///////////////////////////////////////////////////////////////////////////////
+//! A pool of threads for data parallel computations (filtering, sorting). 
+//! Separate from the signac worker threads, so computations do not wait 
+//! behind data loads.
+class ComputePool
+{
+public:
+    static ComputePool* instance();
+
+    //! Sets the number of pool threads. Defaults to the number of cpu cores.
+    //! If parallel loops are running, the change is applied when the last of
+    //! them is done.
+    void setThreads(int threads);
+    int getNumThreads() { return myNumThreads; }
+
+    //! Runs task->run(i) for each chunk i in [0, numChunks). Chunks are run
+    //! by the pool threads and by the calling thread. Returns when all chunks
+    //! are done.
+    void parallelFor(ParallelTask* task, size_t numChunks);
+
+private:
+    // State of a running parallelFor.
+    class Job : public ReferenceType
+    {
+    public:
+        ParallelTask* task;
+        size_t numChunks;
+        size_t next;
+        size_t done;
+        // Protects the chunk counters. The thread that called parallelFor
+        // waits on it for the last chunk.
+        Monitor monitor;
+
+        //! Runs chunks until none is left.
+        void runChunks();
+    };
+
+    // Pool task running the chunks of a job.
+    class JobRunner : public WorkerTask
+    {
+    public:
+        JobRunner(Job* job) : myJob(job) {}
+        void execute(WorkerTask::TaskInfo* ti) { myJob->runChunks(); }
+    private:
+        Ref<Job> myJob;
+    };
+
+    ComputePool();
+    ~ComputePool();
+    //! Restarts the pool with a new number of threads. Called with myLock
+    //! held and no parallel loop running.
+    void applyThreads(int threads);
+
+private:
+    static ComputePool* mysInstance;
+
+    WorkerPool myPool;
+    // Protects the thread count and running loop count.
+    Lock myLock;
+    int myNumThreads;
+    int myActiveJobs;
+    // Thread count requested while loops were running, or 0.
+    int myPendingThreads;
+};
+
+#endif
@@ -0,0 +1,333 @@
+#include "Crossfilter.h"
+
+///////////////////////////////////////////////////////////////////////////////
+// Computes the histogram bin of each element of a field.
+template<typename T>
+static void computeBins(Field* f, int numBins, Vector<uint16_t>& bins)
+{
+    const T* d = (const T*)f->data;
+    size_t n = f->numElements();
+    double vmin = f->getDimension()->floatRangeMin;
+    double vmax = f->getDimension()->floatRangeMax;
+    double scale = vmax > vmin ? numBins / (vmax - vmin) : 0;
+
+    bins.resize(n);
+    for(size_t i = 0; i < n; i++)
+    {
+        T v = d[i];
+        if(v != v)
+        {
+            bins[i] = 0xffff;
+            continue;
+        }
+        double b = (v - vmin) * scale;
+        if(b < 0) b = 0;
+        if(b > numBins - 1) b = numBins - 1;
+        bins[i] = (uint16_t)b;
+    }
+}
+
+///////////////////////////////////////////////////////////////////////////////
+Crossfilter::Crossfilter():
+    myNumRecords(0),
+    mySelected(0),
+    myShownSelected(0),
+    myStamp(0)
+{
+    myDims.reserve(MaxDimensions);
+    myUpdater.start(1);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+Crossfilter::~Crossfilter()
+{
+    foreach(Dim& d, myDims) d.field->getDimension()->dataset->removeLoadListener(this);
+    myUpdater.stop();
+}
+
+///////////////////////////////////////////////////////////////////////////////
+int Crossfilter::addDimension(Field* f, int bins)
+{
+    AutoLock al(myLock);
+    if(myDims.size() >= MaxDimensions)
+    {
+        ofwarn("[Crossfilter::addDimension] too many dimensions (max %1%)", %(int)MaxDimensions);
+        return -1;
+    }
+    Dim d;
+    d.field = f;
+    // Bin indices are 16 bits, with one value reserved for NaN.
+    d.numBins = max(1, min(bins, (int)NoBin));
+    d.hasRange = false;
+    d.rangeMin = 0;
+    d.rangeMax = 0;
+    d.ready = false;
+    d.first = 0;
+    d.last = 0;
+    myDims.push_back(d);
+    queueUpdate();
+    return (int)myDims.size() - 1;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+void Crossfilter::setRange(int dim, float fmin, float fmax)
+{
+    myLock.lock();
+    if(dim >= 0 && dim < (int)myDims.size())
+    {
+        myDims[dim].rangeMin = fmin;
+        myDims[dim].rangeMax = fmax;
+        myDims[dim].hasRange = true;
+    }
+    myLock.unlock();
+    queueUpdate();
+}
+
+///////////////////////////////////////////////////////////////////////////////
+void Crossfilter::setNormalizedRange(int dim, float fmin, float fmax)
+{
+    myLock.lock();
+    if(dim < 0 || dim >= (int)myDims.size())
+    {
+        myLock.unlock();
+        return;
+    }
+    Vector2f r = myDims[dim].field->range();
+    myLock.unlock();
+
+    float delta = r[1] - r[0];
+    setRange(dim, r[0] + delta * fmin, r[0] + delta * fmax);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+void Crossfilter::clearRange(int dim)
+{
+    myLock.lock();
+    if(dim >= 0 && dim < (int)myDims.size()) myDims[dim].hasRange = false;
+    myLock.unlock();
+    queueUpdate();
+}
+
+///////////////////////////////////////////////////////////////////////////////
+int Crossfilter::getNumBins(int dim)
+{
+    AutoLock al(myLock);
+    if(dim < 0 || dim >= (int)myDims.size()) return 0;
+    return myDims[dim].numBins;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+int Crossfilter::getCount(int dim, int bin)
+{
+    AutoLock al(myLock);
+    if(dim < 0 || dim >= (int)myDims.size()) return 0;
+    Dim& d = myDims[dim];
+    if(!d.ready || bin < 0 || bin >= (int)d.shownCounts.size()) return 0;
+    return d.shownCounts[bin];
+}
+
+///////////////////////////////////////////////////////////////////////////////
+int Crossfilter::getSelectedCount()
+{
+    AutoLock al(myLock);
+    return myShownSelected;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+bool Crossfilter::isReady()
+{
+    AutoLock al(myLock);
+    foreach(Dim& d, myDims) if(!d.ready) return false;
+    return true;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+void Crossfilter::queueUpdate()
+{
+    myUpdater.clearQueue();
+    myUpdater.queue(this);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+bool Crossfilter::setup(int di)
+{
+    myLock.lock();
+    Ref<Field> f = myDims[di].field;
+    int numBins = myDims[di].numBins;
+    myLock.unlock();
+
+    // Read the field data once, to compute its bins and sorted index. If
+    // the field is not loaded, loadDone sets it up once it is.
+    f->pin();
+    if(!f->loaded && !f->getDimension()->dataset->load(f, this))
+    {
+        f->unpin();
+        return false;
+    }
+
+    Vector<uint16_t> bins;
+    if(Dataset::useDoublePrecision()) computeBins<double>(f, numBins, bins);
+    else computeBins<float>(f, numBins, bins);
+
+    Ref<SortedIndex> index = f->getSortedIndex();
+    if(index == NULL)
+    {
+        index = SortedIndex::build(f);
+        f->setSortedIndex(index);
+    }
+    f->unpin();
+
+    // Dimension elements do not move (see myDims), and only the updater
+    // writes their record state.
+    Dim& d = myDims[di];
+    if(myMasks.empty())
+    {
+        myNumRecords = bins.size();
+        myMasks.assign(myNumRecords, 0);
+        mySelected = (int)myNumRecords;
+    }
+    if(bins.size() != myNumRecords || index->getNumElements() != myNumRecords)
+    {
+        ofwarn("[Crossfilter::setup] field %1% has %2% elements, expected %3%",
+            %f->getName() %bins.size() %myNumRecords);
+        AutoLock al(myLock);
+        d.ready = true;
+        return true;
+    }
+
+    // The dimension has no range applied yet: all its records pass.
+    uint bit = 1u << di;
+    d.bins.swap(bins);
+    d.index = index;
+    d.first = 0;
+    d.last = index->getNumValid();
+    d.counts.assign(d.numBins, 0);
+    for(size_t r = 0; r < myNumRecords; r++)
+    {
+        if((myMasks[r] & ~bit) == 0 && d.bins[r] != NoBin) d.counts[d.bins[r]]++;
+    }
+
+    AutoLock al(myLock);
+    d.ready = true;
+    return true;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+void Crossfilter::toggle(int di, size_t start, size_t end, bool filterOut)
+{
+    if(start >= end) return;
+
+    const uint* order = myDims[di].index->getOrder();
+    uint bit = 1u << di;
+    int delta = filterOut ? -1 : 1;
+    int numDims = (int)myDims.size();
+    for(size_t p = start; p < end; p++)
+    {
+        uint r = order[p];
+        uint m = myMasks[r];
+        uint rest = m & ~bit;
+        myMasks[r] = filterOut ? (m | bit) : rest;
+
+        if(rest == 0)
+        {
+            // The record passes all other dimensions: it enters or leaves the
+            // selection and the histograms of all other dimensions.
+            mySelected += delta;
+            for(int k = 0; k < numDims; k++)
+            {
+                Dim& dk = myDims[k];
+                if(k == di || dk.bins.empty()) continue;
+                uint16_t b = dk.bins[r];
+                if(b != NoBin) dk.counts[b] += delta;
+            }
+        }
+        else if((rest & (rest - 1)) == 0)
+        {
+            // The record is only filtered out by dimension k: it enters or
+            // leaves the histogram of k.
+            int k = 0;
+            while((rest >> k) != 1) k++;
+            Dim& dk = myDims[k];
+            if(!dk.bins.empty())
+            {
+                uint16_t b = dk.bins[r];
+                if(b != NoBin) dk.counts[b] += delta;
+            }
+        }
+    }
+}
+
+///////////////////////////////////////////////////////////////////////////////
+bool Crossfilter::applyRange(int di)
+{
+    Dim& d = myDims[di];
+    if(d.bins.empty()) return false;
+
+    myLock.lock();
+    bool hasRange = d.hasRange;
+    float rmin = d.rangeMin;
+    float rmax = d.rangeMax;
+    myLock.unlock();
+
+    size_t nf = 0;
+    size_t nl = d.index->getNumValid();
+    if(hasRange) d.index->findRange(rmin, rmax, &nf, &nl);
+
+    size_t of = d.first;
+    size_t ol = d.last;
+    if(nf == of && nl == ol) return false;
+
+    // Records leaving the range: old positions outside the new range.
+    toggle(di, of, min(ol, nf), true);
+    toggle(di, max(of, nl), ol, true);
+    // Records entering the range: new positions outside the old range.
+    toggle(di, nf, min(nl, of), false);
+    toggle(di, max(nf, ol), nl, false);
+
+    d.first = nf;
+    d.last = nl;
+    return true;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+void Crossfilter::publish()
+{
+    AutoLock al(myLock);
+    for(size_t i = 0; i < myDims.size(); i++)
+    {
+        Dim& d = myDims[i];
+        if(d.ready) d.shownCounts = d.counts;
+    }
+    myShownSelected = mySelected;
+    myStamp = otimestamp();
+}
+
+///////////////////////////////////////////////////////////////////////////////
+void Crossfilter::execute(WorkerTask::TaskInfo* ti)
+{
+    myLock.lock();
+    int numDims = (int)myDims.size();
+    myLock.unlock();
+
+    // Set up new dimensions. Only the updater sets dimensions ready.
+    bool changed = false;
+    for(int i = 0; i < numDims; i++)
+    {
+        if(!myDims[i].ready) changed |= setup(i);
+    }
+
+    // Apply range changes to the updater histograms, then publish them.
+    for(int i = 0; i < numDims; i++)
+    {
+        if(myDims[i].ready) changed |= applyRange(i);
+    }
+    if(changed) publish();
+}
+
+///////////////////////////////////////////////////////////////////////////////
+void Crossfilter::loadDone(Field* f)
+{
+    // Failed or cancelled loads are not retried until the next update.
+    if(!f->loaded) return;
+    queueUpdate();
+}
@@ -0,0 +1,107 @@
+#ifndef __CROSSFILTER__
+#define __CROSSFILTER__
+
+#include <omega.h>
+#include "Dataset.h"
+
+using namespace omega;
+
+///////////////////////////////////////////////////////////////////////////////
+//! Coordinated range filters over fields of the same length (i.e. the
+//! columns shown in linked plots). Each dimension keeps a histogram of the
+//! records that pass the filters of all the other dimensions: the histogram a
+//! linked view shows for that dimension.
+//! Each record stores a bit mask of the dimensions filtering it out. When a
+//! dimension range moves, only the records that crossed its boundaries are
+//! visited (found through the field sorted index), and the histograms are
+//! updated by adding or removing them. Field data is only read when a
+//! dimension is set up; later range changes do not scan the data.
+//! Range changes are applied by the updater to its own copy of the 
+//! histograms, which is then published under the lock: readers never wait
+//! for range changes to be applied.
+class Crossfilter : public WorkerTask, public LoadListener
+{
+public:
+    static const int MaxDimensions = 32;
+
+    Crossfilter();
+    ~Crossfilter();
+
+    //! Adds a dimension, with a histogram of bins bins over the dimension
+    //! range. Returns the dimension index. The field is loaded if needed,
+    //! and the dimension is set up in the background.
+    int addDimension(Field* f, int bins);
+    void setRange(int dim, float fmin, float fmax);
+    void setNormalizedRange(int dim, float fmin, float fmax);
+    //! Removes the range of a dimension: all its records pass.
+    void clearRange(int dim);
+
+    int getNumBins(int dim);
+    //! Returns the number of records in a histogram bin of a dimension that
+    //! pass the ranges of the other dimensions.
+    int getCount(int dim, int bin);
+    //! Returns the number of records passing all ranges.
+    int getSelectedCount();
+    //! Returns the time of the last histogram change.
+    double getStamp() { return myStamp; }
+    //! Returns true when all dimensions are set up.
+    bool isReady();
+
+    void execute(WorkerTask::TaskInfo* ti);
+    void loadDone(Field* f);
+
+private:
+    struct Dim
+    {
+        Ref<Field> field;
+        int numBins;
+        // Requested range, and whether it is set.
+        float rangeMin;
+        float rangeMax;
+        bool hasRange;
+
+        bool ready;
+        Ref<SortedIndex> index;
+        // Sorted index positions of the records passing the applied range.
+        size_t first;
+        size_t last;
+        // Histogram bin of each record (NoBin for NaN values).
+        Vector<uint16_t> bins;
+        // Histogram updated by the updater, and the copy published to
+        // readers.
+        Vector<int> counts;
+        Vector<int> shownCounts;
+    };
+
+    static const uint16_t NoBin = 0xffff;
+
+    void queueUpdate();
+    //! Sets up dimension d. Returns false if its field is not loaded yet.
+    bool setup(int d);
+    //! Applies the current range of dimension d. Returns true if the
+    //! histograms changed.
+    bool applyRange(int d);
+    //! Copies the updater histograms and selected count to the readers.
+    void publish();
+    //! Moves sorted index positions [start, end) of dimension d in or out of
+    //! its range.
+    void toggle(int d, size_t start, size_t end, bool filterOut);
+
+private:
+    WorkerPool myUpdater;
+    // Protects the dimension list, ranges and published histograms. Record
+    // masks, bins and updater histograms are only used by the updater.
+    Lock myLock;
+
+    // Reserved for MaxDimensions, so the updater can use dimensions while
+    // new ones are added.
+    Vector<Dim> myDims;
+    size_t myNumRecords;
+    // Bit mask of the dimensions filtering out each record.
+    Vector<uint> myMasks;
+    int mySelected;
+    int myShownSelected;
+    double myStamp;
+};
+
+#endif
@@ -1,4 +1,5 @@
 #include "CsvLoader.h"
+#include "FieldAllocator.h"
 
 // Maximum number of rows that can be read for each loaded block.
 #define MAX_ROWS_PER_BLOCK 65535
@@ -10,11 +11,14 @@ class LoadTask : public WorkerTask
 public:
     Ref<Field> field;
     String path;
+    LoadScheduler* scheduler;
     uint blockStart;
     uint blockLength;
+    // Rows appended to the field by this task so far.
+    size_t rowsLoaded;
     char** rows;
     
-    LoadTask()
+    LoadTask(): rowsLoaded(0)
     {
         rows = (char**)malloc(MAX_ROWS_PER_BLOCK * sizeof(char*));
     }
@@ -68,6 +72,18 @@ public:
 
     void execute(WorkerTask::TaskInfo* ti)
     {
+        // Blocks are loaded one task run at a time: if the field load was 
+        // cancelled since the last block, drop what we loaded so far.
+        Dataset* ds = field->getDimension()->dataset;
+        if(field->cancelled)
+        {
+            field->lock.lock();
+            field->domain.length -= rowsLoaded;
+            field->lock.unlock();
+            ds->loadCancelled(field);
+            return;
+        }
+
         String fullpath;
         if(DataManager::findFile(path, fullpath))
         {
@@ -77,6 +93,11 @@ public:
             if(f == NULL)
             {
                 oferror("[signac:LoadTask] Could not open file %1%", %fullpath);
+                field->lock.lock();
+                field->domain.length -= rowsLoaded;
+                field->lock.unlock();
+                ds->loadFailed(field);
+                return;
             }
             
             fseek(f, blockStart, SEEK_SET);
@@ -110,23 +131,21 @@ public:
             field->lock.lock();
             // Extend the field data memory and copy the new data into it.
             size_t elemSize = field->getDimension()->getElementSize();
-            if(field->data == NULL)
-            {
-                field->data = (char*)malloc(nrows * elemSize);
-            }
-            else
-            {
-                field->data = (char*)realloc(field->data, (field->domain.length + nrows) * elemSize);
-            }
+            // Field buffers grow in power of two size classes, so most blocks
+            // are appended in place.
+            field->data = (char*)FieldAllocator::reallocate(
+                field->data, (field->domain.length + nrows) * elemSize);
             memcpy(
                 &field->data[field->domain.length * field->getDimension()->getElementSize()],
                 data,
                 nrows * elemSize);
 
             // Update field length
+            size_t offset = field->domain.length * elemSize;
             field->domain.length += nrows;
+            rowsLoaded += nrows;
             field->loaded = final;
-            field->stamp = otimestamp();
+            field->dataAppended(offset, nrows * elemSize);
             //ofmsg("Field %1% l=%2%", %field->getInfo()->id %field->length);
 
             field->lock.unlock();
@@ -137,15 +156,24 @@ public:
 
             if(final)
             {
+                ds->loadCompleted(field);
                 ofmsg("Loading %1% finished", %field->getDimension()->id);
             }
             else
             {
                 blockStart += BLOCK_SIZE;
                 //ofmsg("Queuing block %1%", %blockStart);
-                getPool()->queue(this);
+                scheduler->queue(this, field);
             }
         }
+        else
+        {
+            ofwarn("[signac:LoadTask] could not find %1%", %path);
+            field->lock.lock();
+            field->domain.length -= rowsLoaded;
+            field->lock.unlock();
+            ds->loadFailed(field);
+        }
     }
 
 };
@@ -153,23 +181,28 @@ public:
 ///////////////////////////////////////////////////////////////////////////////
 CsvLoader::~CsvLoader()
 {
-    myLoaderPool.stop();
+    myLoadScheduler.stop();
 }
 
 ///////////////////////////////////////////////////////////////////////////////
 void CsvLoader::open(const String& source)
 {
     myFilename = source;
-    myLoaderPool.start(4);
+    myLoadScheduler.start(4);
 }
 
 ///////////////////////////////////////////////////////////////////////////////
 void CsvLoader::load(Field* f)
 {
+    // CSV loads append rows to the field, starting from an empty domain. The
+    // field may have been loaded (and evicted) before.
+    f->domain.length = 0;
+
     LoadTask* task = new LoadTask();
     task->field = f;
     task->blockStart = 0;
     task->blockLength = BLOCK_SIZE;
     task->path = myFilename;
-    myLoaderPool.queue(task);
+    task->scheduler = &myLoadScheduler;
+    myLoadScheduler.queue(task, f);
 }
@@ -2,6 +2,7 @@
 #define __CSVLOADER_H__
 
 #include "Loader.h"
+#include "LoadScheduler.h"
 
 using namespace omega;
 
@@ -13,9 +14,10 @@ public:
 
     void open(const String& source);
     void load(Field* f);
+    String getSource() { return myFilename; }
 
 private:
     String myFilename;
-    WorkerPool myLoaderPool;
+    LoadScheduler myLoadScheduler;
 };
 #endif
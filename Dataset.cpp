@@ -1,11 +1,25 @@
 #include "Dataset.h"
 #include "Loader.h"
+#include "FieldCache.h"
+#include "FieldAllocator.h"
+#include "UploadScheduler.h"
+#include "signac.h"
+
+#include <algorithm>
+
+// Time during which a requested field priority can only be raised.
+#define PRIORITY_HOLD_TIME 0.1
+// Maximum number of dirty ranges kept for a field. Older ranges are merged
+// past this.
+#define MAX_DIRTY_RANGES 32
 
 bool Dataset::mysDoublePrecision = false;
+const float Field::DefaultPriority = 2.0f;
 
 ///////////////////////////////////////////////////////////////////////////////
 Dimension::Dimension():
-dataset(NULL)
+dataset(NULL),
+sortedIndex(false)
 {
     floatRangeMax = -std::numeric_limits<float>::max();
     floatRangeMin = std::numeric_limits<float>::max();
@@ -28,22 +42,169 @@ Field::Field(Dimension* info, const Domain& dom):
     data(NULL),
     loaded(false),
     loading(false),
-    stamp(0)
+    cancelled(false),
+    failed(false),
+    stamp(0),
+    version(0),
+    priority(DefaultPriority),
+    priorityStamp(0),
+    lastUsed(0),
+    cachedBytes(0),
+    myUsers(0),
+    myPins(0),
+    myRewriteVersion(0),
+    myHasNaN(false)
 {
     boundMax = -std::numeric_limits<float>::max();
     boundMin = std::numeric_limits<float>::max();
 }
 
+///////////////////////////////////////////////////////////////////////////////
+// Uploads field data to a gpu buffer.
+class GpuBufferUploadTarget : public UploadTarget
+{
+public:
+    GpuBufferUploadTarget(GpuBuffer* buffer) : myBuffer(buffer) {}
+
+    bool allocate(size_t capacity, const void* data, size_t size)
+    {
+        if(capacity == size) return myBuffer->setData(size, (void*)data);
+        if(!myBuffer->setData(capacity, NULL)) return false;
+        return myBuffer->setSubData(0, size, (void*)data);
+    }
+
+    bool upload(size_t offset, size_t size, const void* data)
+    {
+        return myBuffer->setSubData(offset, size, (void*)data);
+    }
+
+private:
+    GpuBuffer* myBuffer;
+};
+
+///////////////////////////////////////////////////////////////////////////////
+void Field::dataChanged()
+{
+    version++;
+    myRewriteVersion = version;
+    myDirtyRanges.clear();
+    stamp = otimestamp();
+    // Evicted or cancelled data loses its zone map: it no longer describes
+    // the data that will be loaded next.
+    if(data != NULL) updateZones(0);
+    else clearZones();
+}
+
+///////////////////////////////////////////////////////////////////////////////
+SortedIndex* Field::getSortedIndex()
+{
+    AutoLock al(lock);
+    if(mySortedIndex == NULL || mySortedIndex->getVersion() != version) return NULL;
+    return mySortedIndex;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+void Field::setSortedIndex(SortedIndex* index)
+{
+    AutoLock al(lock);
+    mySortedIndex = index;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+void Field::dataAppended(size_t offset, size_t size)
+{
+    version++;
+    if(myDirtyRanges.size() >= MAX_DIRTY_RANGES)
+    {
+        // Merge the two oldest ranges. Contexts that uploaded only the first
+        // of them will upload it again.
+        DirtyRange& a = myDirtyRanges[0];
+        DirtyRange& b = myDirtyRanges[1];
+        size_t end = max(a.offset + a.size, b.offset + b.size);
+        b.offset = min(a.offset, b.offset);
+        b.size = end - b.offset;
+        myDirtyRanges.erase(myDirtyRanges.begin());
+    }
+    DirtyRange r = { offset, size, version };
+    myDirtyRanges.push_back(r);
+    stamp = otimestamp();
+    updateZones(offset / myInfo->getElementSize());
+}
+
+///////////////////////////////////////////////////////////////////////////////
+template<typename T>
+void Field::computeZones(size_t firstZone, size_t numElements)
+{
+    const T* d = (const T*)data;
+    for(size_t start = firstZone * ZoneSize; start < numElements; start += ZoneSize)
+    {
+        size_t end = min(start + ZoneSize, numElements);
+        Zone z;
+        z.min = numeric_limits<double>::max();
+        z.max = -numeric_limits<double>::max();
+        z.hasNaN = false;
+        for(size_t i = start; i < end; i++)
+        {
+            T v = d[i];
+            if(v != v) z.hasNaN = true;
+            else
+            {
+                z.min = z.min < v ? z.min : v;
+                z.max = z.max > v ? z.max : v;
+            }
+        }
+        myZones.push_back(z);
+    }
+}
+
+///////////////////////////////////////////////////////////////////////////////
+void Field::updateZones(size_t first)
+{
+    // Zones from the one containing first are computed again.
+    size_t firstZone = min(first / ZoneSize, myZones.size());
+    myZones.resize(firstZone);
+
+    size_t n = getDataSize() / myInfo->getElementSize();
+    if(Dataset::useDoublePrecision()) computeZones<double>(firstZone, n);
+    else computeZones<float>(firstZone, n);
+
+    boundMin = numeric_limits<float>::max();
+    boundMax = -numeric_limits<float>::max();
+    myHasNaN = false;
+    foreach(const Zone& z, myZones)
+    {
+        myHasNaN |= z.hasNaN;
+        boundMin = boundMin < z.min ? boundMin : z.min;
+        boundMax = boundMax > z.max ? boundMax : z.max;
+    }
+}
+
+///////////////////////////////////////////////////////////////////////////////
+void Field::clearZones()
+{
+    myZones.clear();
+    myHasNaN = false;
+    boundMin = numeric_limits<float>::max();
+    boundMax = -numeric_limits<float>::max();
+}
+
 ///////////////////////////////////////////////////////////////////////////////
 GpuBuffer* Field::getGpuBuffer(const DrawContext& dc)
 {
+    FieldCache::instance()->touch(this);
+    uint ctx = dc.gpuContext->getId();
     if(data == NULL)
     {
-        myInfo->dataset->load(this);
+        // The buffer may still be there if the field was evicted since the
+        // start of the frame.
+        releaseGpuBuffer(dc);
+        if(!failed) myInfo->dataset->load(this);
         return NULL;
     }
     if(myGpuBuffer(dc) == NULL)
     {
+        // Buffers of this context get released when the field is evicted.
+        FieldCache::instance()->addGpuContext(ctx);
         myGpuBuffer(dc) = dc.gpuContext->createVertexBuffer();
         myGpuBuffer(dc)->setType(GpuBuffer::VertexData);
         myGpuBuffer(dc)->setAttribute(0,
@@ -52,12 +213,33 @@ GpuBuffer* Field::getGpuBuffer(const DrawContext& dc)
     }
 
     // Do we need to update the gpu buffer with new data?
-    if(myGpuBuffer.stamp(dc) < stamp)
+    if(myGpuBuffer.stamp(dc) < version)
     {
         lock.lock();
-        myGpuBuffer.stamp(dc) = stamp;
-        size_t sz = domain.length * myInfo->getElementSize() / domain.decimation;
-        myGpuBuffer(dc)->setData(sz, data);
+        // The field may have been evicted since we checked.
+        if(data == NULL)
+        {
+            lock.unlock();
+            return NULL;
+        }
+        if(ctx >= myUploads.size()) myUploads.resize(ctx + 1);
+        UploadPolicy& up = myUploads[ctx];
+        size_t size = getDataSize();
+
+        // Wait for upload budget. In the meantime the old buffer content can
+        // still be drawn, unless the field data shrank. Growing fields draw
+        // the elements uploaded so far.
+        size_t bytes = up.getUpdateSize(size, version, myRewriteVersion, myDirtyRanges);
+        if(!UploadScheduler::instance()->requestUpload(dc, this, bytes))
+        {
+            bool stale = up.isValid() && up.getSize() <= size;
+            lock.unlock();
+            return stale ? myGpuBuffer(dc) : NULL;
+        }
+
+        myGpuBuffer.stamp(dc) = version;
+        GpuBufferUploadTarget target(myGpuBuffer(dc));
+        up.update(&target, data, size, version, myRewriteVersion, myDirtyRanges);
         //ofmsg("[Field::getGpuBuffer update] field %1% length %2%", %myInfo->id %length);
         lock.unlock();
     }
@@ -65,6 +247,48 @@ GpuBuffer* Field::getGpuBuffer(const DrawContext& dc)
 }
 
 
+///////////////////////////////////////////////////////////////////////////////
+void Field::releaseGpuBuffer(const DrawContext& dc)
+{
+    // The field may have been loaded again since it was evicted: keep its
+    // buffer then.
+    AutoLock al(lock);
+    if(data != NULL || myGpuBuffer(dc) == NULL) return;
+    myGpuBuffer(dc) = NULL;
+    uint ctx = dc.gpuContext->getId();
+    if(ctx < myUploads.size()) myUploads[ctx].reset();
+}
+
+///////////////////////////////////////////////////////////////////////////////
+size_t Field::getGpuLength(const DrawContext& dc)
+{
+    AutoLock al(lock);
+    uint ctx = dc.gpuContext->getId();
+    if(ctx >= myUploads.size() || !myUploads[ctx].isValid()) return 0;
+    return myUploads[ctx].getSize() / myInfo->getElementSize();
+}
+
+///////////////////////////////////////////////////////////////////////////////
+void Field::requestPriority(float p)
+{
+    double now = otimestamp();
+    if(p >= priority || now - priorityStamp > PRIORITY_HOLD_TIME)
+    {
+        priority = p;
+        priorityStamp = now;
+    }
+}
+
+///////////////////////////////////////////////////////////////////////////////
+float Field::getEffectivePriority(double now)
+{
+    // Fields that never had a priority requested keep the default one.
+    if(priorityStamp == 0) return priority;
+    double age = now - priorityStamp;
+    if(age < PRIORITY_HOLD_TIME) return priority;
+    return priority / (float)(1.0 + age);
+}
+
 ///////////////////////////////////////////////////////////////////////////////
 Dataset::Dataset(const String& name):
     myLoader(NULL),
@@ -93,33 +317,94 @@ Dimension* Dataset::addDimension(const String& name, Dimension::Type type, int i
     fi->type = type;
 
     myDimensions.push_back(fi);
+    // The new dimension may provide data that was missing.
+    resetFailedLoads();
     return fi;
 }
 
 ///////////////////////////////////////////////////////////////////////////////
-Field* Dataset::addField(Dimension* dim, const Domain& dom)
+size_t Dataset::FieldKeyHash::operator()(const FieldKey& k) const
+{
+    size_t seed = 0;
+    boost::hash_combine(seed, k.dimension);
+    boost::hash_combine(seed, k.start);
+    boost::hash_combine(seed, k.length);
+    boost::hash_combine(seed, k.decimation);
+    return seed;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+Dataset::FieldKey Dataset::makeKey(Dimension* dimension, const Domain& domain)
+{
+    FieldKey k = { dimension, domain.start, domain.length, domain.decimation };
+    return k;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+Field* Dataset::createField(Dimension* dim, const Domain& dom)
 {
     Field* f = new Field(dim, dom);
     myFields.push_back(f);
+    myFieldIndex[makeKey(dim, dom)] = f;
     return f;
 }
 
+///////////////////////////////////////////////////////////////////////////////
+Field* Dataset::addField(Dimension* dim, const Domain& dom)
+{
+    AutoLock al(myFieldLock);
+    return createField(dim, dom);
+}
+
 ///////////////////////////////////////////////////////////////////////////////
 Field* Dataset::findField(Dimension* dimension, const Domain& domain)
 {
+    AutoLock al(myFieldLock);
+    FieldIndex::iterator it = myFieldIndex.find(makeKey(dimension, domain));
+    if(it == myFieldIndex.end()) return NULL;
+    return it->second;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+void Dataset::getFields(Dimension* dimension, Vector<Field*>& fields)
+{
+    AutoLock al(myFieldLock);
     foreach(Field* f, myFields)
     {
-        if(f->getDimension() == dimension && f->domain == domain) return f;
+        if(f->getDimension() == dimension) fields.push_back(f);
     }
-    return NULL;
 }
 
 ///////////////////////////////////////////////////////////////////////////////
 Field* Dataset::getOrCreateField(Dimension* dimension, const Domain& domain)
 {
-    Field* f = findField(dimension, domain);
-    if(f == NULL) f = addField(dimension, domain);
-    return f;
+    AutoLock al(myFieldLock);
+    FieldIndex::iterator it = myFieldIndex.find(makeKey(dimension, domain));
+    if(it != myFieldIndex.end()) return it->second;
+    return createField(dimension, domain);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+void Dataset::getOrCreateFields(Dimension** dimensions, int n, const Domain& domain, Field** fields)
+{
+    for(int i = 0; i < n; i++)
+    {
+        Dimension* dim = dimensions[i];
+        if(dim == NULL)
+        {
+            fields[i] = NULL;
+        }
+        // Dimensions are often repeated (i.e. the same dimension used for
+        // position and data): reuse the field we just looked up.
+        else if(i > 0 && dim == dimensions[i - 1])
+        {
+            fields[i] = fields[i - 1];
+        }
+        else
+        {
+            fields[i] = getOrCreateField(dim, domain);
+        }
+    }
 }
 
 ///////////////////////////////////////////////////////////////////////////////
@@ -127,15 +412,156 @@ void Dataset::setLoader(Loader* loader)
 {
     myLoader = loader;
     myLoader->ref();
+    resetFailedLoads();
 }
 
 ///////////////////////////////////////////////////////////////////////////////
 void Dataset::load(Field* f)
 {
-    if(!f->loading && !f->loaded)
+    myLoadLock.lock();
+    if(f->failed)
+    {
+        // Do not retry loads that failed. Listeners get notified right away
+        // so they do not wait for the field.
+        notifyLoadDone(f);
+        myLoadLock.unlock();
+    }
+    else if(f->loading)
+    {
+        // The field is wanted again before its cancellation was picked up by
+        // the loader: just keep loading it.
+        f->cancelled = false;
+        myLoadLock.unlock();
+    }
+    else if(!f->loaded)
     {
         f->loading = true;
+        myPendingLoads.push_back(f);
+        myLoadLock.unlock();
         //ofmsg("[Field::getGpuBuffer queue for load] field %1%", %f->getName());
         myLoader->load(f);
     }
+    else
+    {
+        myLoadLock.unlock();
+    }
+}
+
+///////////////////////////////////////////////////////////////////////////////
+void Dataset::cancel(Field* f)
+{
+    AutoLock al(myLoadLock);
+    if(f->loading && !f->loaded) f->cancelled = true;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+size_t Dataset::getNumPendingLoads()
+{
+    AutoLock al(myLoadLock);
+    return myPendingLoads.size();
+}
+
+///////////////////////////////////////////////////////////////////////////////
+bool Dataset::load(Field* f, LoadListener* l)
+{
+    myLoadLock.lock();
+    if(f->loaded && !f->loading)
+    {
+        myLoadLock.unlock();
+        return true;
+    }
+    List<LoadListener*>& listeners = myLoadListeners[f];
+    if(std::find(listeners.begin(), listeners.end(), l) == listeners.end())
+    {
+        listeners.push_back(l);
+    }
+    myLoadLock.unlock();
+
+    load(f);
+    return false;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+void Dataset::removeLoadListener(LoadListener* l)
+{
+    AutoLock al(myLoadLock);
+    LoadListenerMap::iterator it = myLoadListeners.begin();
+    while(it != myLoadListeners.end())
+    {
+        it->second.remove(l);
+        if(it->second.empty()) myLoadListeners.erase(it++);
+        else ++it;
+    }
+}
+
+///////////////////////////////////////////////////////////////////////////////
+void Dataset::notifyLoadDone(Field* f)
+{
+    // Listeners are notified with the load lock held, so they can not be
+    // removed (and deleted) while we notify them.
+    LoadListenerMap::iterator it = myLoadListeners.find(f);
+    if(it == myLoadListeners.end()) return;
+    List<LoadListener*> listeners;
+    listeners.swap(it->second);
+    myLoadListeners.erase(it);
+    foreach(LoadListener* l, listeners) l->loadDone(f);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+void Dataset::loadCompleted(Field* f)
+{
+    myLoadLock.lock();
+    f->loading = false;
+    f->cancelled = false;
+    myPendingLoads.remove(f);
+    myLoadLock.unlock();
+
+    FieldCache::instance()->add(f);
+
+    if(f->getDimension()->sortedIndex) Signac::instance->addTask(new SortedIndexTask(f));
+
+    myLoadLock.lock();
+    notifyLoadDone(f);
+    myLoadLock.unlock();
+}
+
+///////////////////////////////////////////////////////////////////////////////
+void Dataset::loadCancelled(Field* f)
+{
+    //ofmsg("[Dataset::loadCancelled] field %1%", %f->getName());
+    f->lock.lock();
+    if(f->data != NULL)
+    {
+        FieldAllocator::free(f->data);
+        f->data = NULL;
+    }
+    f->loaded = false;
+    f->dataChanged();
+    f->lock.unlock();
+
+    AutoLock al(myLoadLock);
+    f->loading = false;
+    f->cancelled = false;
+    myPendingLoads.remove(f);
+    notifyLoadDone(f);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+void Dataset::loadFailed(Field* f)
+{
+    myLoadLock.lock();
+    f->failed = true;
+    myLoadLock.unlock();
+    loadCancelled(f);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+void Dataset::resetFailedLoads()
+{
+    myFieldLock.lock();
+    FieldList fields = myFields;
+    myFieldLock.unlock();
+
+    AutoLock al(myLoadLock);
+    foreach(Field* f, fields) f->failed = false;
 }
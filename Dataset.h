@@ -1,6 +1,9 @@
 #ifndef __DATASET_H__
 #define __DATASET_H__
 #include <omega.h>
+#include <boost/unordered_map.hpp>
+#include "UploadPolicy.h"
+#include "SortedIndex.h"
 
 using namespace omega;
 
@@ -54,6 +57,11 @@ public:
     double floatRangeMin;
     double floatRangeMax;
 
+    //! When set, a sorted index is built for fields of this dimension when
+    //! they finish loading. Filters use it to answer selective range queries
+    //! without scanning the field.
+    bool sortedIndex;
+
     size_t getElementSize();
 
 };
@@ -63,21 +71,103 @@ class Dataset;
 ///////////////////////////////////////////////////////////////////////////////
 class Field : public ReferenceType
 {
+public:
+    //! Load priority of fields that never had a priority requested (i.e. 
+    //! plot and filter fields)
+    static const float DefaultPriority;
+    //! Number of elements in each zone of the field zone map.
+    static const uint ZoneSize = 4096;
+
+    //! Value range of a zone (a chunk of ZoneSize elements) of the field.
+    struct Zone
+    {
+        double min;
+        double max;
+        //! NaN values are not part of the zone range.
+        bool hasNaN;
+    };
+
 public:
     Field(Dimension* info, const Domain& dom);
 
     char* data;
     bool loaded;
     bool loading;
+    //! Set when a pending load of this field is no longer needed. Loaders
+    //! check it between chunks and abandon the load.
+    bool cancelled;
+    //! Set when the field source is missing or unreadable. Failed fields are
+    //! not loaded again until the dataset loader or dimensions change.
+    bool failed;
     Domain domain;
     double stamp;
+    //! Incremented each time the field data changes.
+    uint version;
     double boundMin;
     double boundMax;
 
+    // Load priority: fields with a higher priority are loaded first.
+    float priority;
+    double priorityStamp;
+
+    // Field cache state: frame of last use and bytes accounted in the cache.
+    uint lastUsed;
+    size_t cachedBytes;
+
     Lock lock;
 
     Dimension* getDimension() { return myInfo; }
+
+    //! Pinned fields are never evicted from the field cache. Pin a field
+    //! before reading its data outside of the field lock.
+    void pin() { lock.lock(); myPins++; lock.unlock(); }
+    void unpin() { lock.lock(); myPins--; lock.unlock(); }
+    bool isPinned() { return myPins > 0; }
+
+    //! Number of batch drawables using this field. When it drops to zero, 
+    //! pending loads of the field get cancelled.
+    void addUser() { myUsers++; }
+    int removeUser() { return --myUsers; }
+
+    //! Returns the gpu buffer of the field data. While an upload waits for
+    //! budget, the previous buffer content is returned: it can hold fewer
+    //! elements than the field (see getGpuLength).
     GpuBuffer* getGpuBuffer(const DrawContext& dc);
+    //! Returns the number of elements in the gpu buffer of a context.
+    size_t getGpuLength(const DrawContext& dc);
+    //! Releases the gpu buffer of a context if the field data was evicted. 
+    //! Called by the field cache on render threads.
+    void releaseGpuBuffer(const DrawContext& dc);
+
+    //! Called by loaders (with the field lock held) after replacing the field
+    //! data as a whole.
+    void dataChanged();
+    //! Called by loaders (with the field lock held) after writing size bytes
+    //! of field data at offset. Only modified ranges get uploaded to the gpu.
+    void dataAppended(size_t offset, size_t size);
+
+    //! Returns the number of zones in the field zone map. The zone map is 
+    //! computed as data is loaded, and cleared when the field data is evicted
+    //! or its load cancelled. It only covers the whole field once the field
+    //! is loaded.
+    size_t getNumZones() { return myZones.size(); }
+    const Zone& getZone(size_t i) { return myZones[i]; }
+    //! Returns true if any zone contains NaN values.
+    bool hasNaN() { return myHasNaN; }
+
+    //! Returns the sorted index of the field, or NULL if the field has none
+    //! or its data changed since the index was built.
+    SortedIndex* getSortedIndex();
+    void setSortedIndex(SortedIndex* index);
+
+    //! Requests a load priority for this field. For a short time after a
+    //! request only higher priorities replace it, so a field shared by several
+    //! drawables ends up with the highest of their priorities.
+    void requestPriority(float p);
+    //! Returns the priority used to schedule the field load. Requested 
+    //! priorities decay as they age, so fields nobody asks for anymore sink
+    //! to the back of the queue.
+    float getEffectivePriority(double now);
 
     Vector2f range()
     {
@@ -94,14 +184,52 @@ public:
         return domain.length / domain.decimation;
     }
 
+    //! Size of the field data in bytes.
+    size_t getDataSize()
+    {
+        int dec = domain.decimation > 0 ? domain.decimation : 1;
+        return domain.length / dec * myInfo->getElementSize();
+    }
+
 private:
     Ref<Dimension> myInfo;
+    int myUsers;
+    int myPins;
 
     GpuRef<GpuBuffer> myGpuBuffer;
+    // Gpu upload state for each gpu context, indexed by context id.
+    Vector<UploadPolicy> myUploads;
+    // Version of the last whole data replacement, and ranges modified since.
+    uint myRewriteVersion;
+    Vector<DirtyRange> myDirtyRanges;
+
+    Vector<Zone> myZones;
+    bool myHasNaN;
+
+    Ref<SortedIndex> mySortedIndex;
+
+private:
+    //! Recomputes the zone map starting from the zone containing element
+    //! first, and updates the field bounds.
+    void updateZones(size_t first);
+    void clearZones();
+    template<typename T> void computeZones(size_t firstZone, size_t numElements);
 };
 
 class Loader;
 
+///////////////////////////////////////////////////////////////////////////////
+//! Gets notified when field loads it waits for are done. See Dataset::load.
+class LoadListener
+{
+public:
+    virtual ~LoadListener() {}
+    //! Called when the load of f completes or is cancelled (check 
+    //! f->loaded). Called from loader threads, with the dataset load lock
+    //! held: only schedule work here.
+    virtual void loadDone(Field* f) = 0;
+};
+
 ///////////////////////////////////////////////////////////////////////////////
 class Dataset : public ReferenceType
 {
@@ -120,22 +248,83 @@ public:
     Dimension* addDimension(const String& name, Dimension::Type type, int index, const String& label);
     Field* addField(Dimension* dimension, const Domain& domain);
     Field* findField(Dimension* dimension, const Domain& domain);
+    //! Gets all the fields of a dimension.
+    void getFields(Dimension* dimension, Vector<Field*>& fields);
     Field* getOrCreateField(Dimension* dimension, const Domain& domain);
+    //! Bulk version of getOrCreateField: gets the fields of n dimensions over
+    //! the same domain. Entries of dimensions that are NULL are set to NULL.
+    void getOrCreateFields(Dimension** dimensions, int n, const Domain& domain, Field** fields);
 
     void setLoader(Loader* loader);
     Loader* getLoader() { return myLoader; }
     size_t getNumRecords();
 
     void load(Field* f);
+    //! Loads f if needed, and notifies l once when the load is done. Returns
+    //! true if f is already loaded: l is not notified then.
+    bool load(Field* f, LoadListener* l);
+    //! Removes l from all pending load notifications.
+    void removeLoadListener(LoadListener* l);
+    //! Cancels a pending load of f. Completed loads are not affected.
+    void cancel(Field* f);
+    size_t getNumPendingLoads();
+
+    //! Called by loaders when a field finished loading.
+    void loadCompleted(Field* f);
+    //! Called by loaders when they abandon the load of a cancelled field.
+    //! Frees any partially loaded data and resets the field load state.
+    void loadCancelled(Field* f);
+    //! Called by loaders when a field can not be loaded. Like loadCancelled,
+    //! and marks the field as failed.
+    void loadFailed(Field* f);
+    //! Clears the failed state of all fields, so they get loaded again.
+    void resetFailedLoads();
+
+private:
+    // Field index key. Fields are indexed by the domain they were created
+    // with: loaders may change the field domain while loading.
+    struct FieldKey
+    {
+        Dimension* dimension;
+        size_t start;
+        size_t length;
+        int decimation;
+
+        bool operator==(const FieldKey& rhs) const
+        {
+            return dimension == rhs.dimension && start == rhs.start &&
+                length == rhs.length && decimation == rhs.decimation;
+        }
+    };
+    struct FieldKeyHash
+    {
+        size_t operator()(const FieldKey& k) const;
+    };
+
+    static FieldKey makeKey(Dimension* dimension, const Domain& domain);
+    //! Notifies the listeners of a field load. Call with the load lock held.
+    void notifyLoadDone(Field* f);
+    //! Creates a field. Call with the field lock held.
+    Field* createField(Dimension* dimension, const Domain& domain);
 
 private:
     static bool mysDoublePrecision;
 
     typedef List< Ref<Field> > FieldList;
     typedef List< Ref<Dimension> > DimensionList;
+    typedef boost::unordered_map<FieldKey, Field*, FieldKeyHash> FieldIndex;
 
     DimensionList myDimensions;
     FieldList myFields;
+    FieldIndex myFieldIndex;
+    // Protects the field list and index: dataset filters look up fields from
+    // their own thread.
+    Lock myFieldLock;
+    FieldList myPendingLoads;
+    // Listeners waiting for pending loads.
+    typedef std::map< Field*, List<LoadListener*> > LoadListenerMap;
+    LoadListenerMap myLoadListeners;
+    Lock myLoadLock;
     String myFilename;
     Loader* myLoader;
     String myName;
@@ -0,0 +1,281 @@
+#include "DatasetFilter.h"
+#include "FilterKernel.h"
+#include "ComputePool.h"
+
+///////////////////////////////////////////////////////////////////////////////
+// Filters one domain of a dataset filter.
+struct DomainJob
+{
+    Domain domain;
+    Field* fields[DatasetFilter::MaxDimensions];
+    // Field versions when the job started.
+    uint versions[DatasetFilter::MaxDimensions];
+    Ref<Bitmap> result;
+};
+
+///////////////////////////////////////////////////////////////////////////////
+// Filters the domains of a dataset filter in parallel, one domain per chunk.
+class DomainFilterTask : public ParallelTask
+{
+public:
+    Vector<DomainJob>* jobs;
+    int numDimensions;
+    float vmin[DatasetFilter::MaxDimensions];
+    float vmax[DatasetFilter::MaxDimensions];
+
+    void run(size_t chunk)
+    {
+        DomainJob& job = (*jobs)[chunk];
+        const void* columns[DatasetFilter::MaxDimensions];
+        size_t n = job.fields[0]->numElements();
+        for(int i = 0; i < numDimensions; i++)
+        {
+            columns[i] = job.fields[i]->data;
+            n = min(n, job.fields[i]->numElements());
+        }
+
+        Vector<uint> indices(n + FilterKernel::OutputPadding);
+        uint len = FilterKernel::run(columns, numDimensions, Dataset::useDoublePrecision(),
+            vmin, vmax, 0, (uint)n, &indices[0]);
+        job.result = Bitmap::fromSorted(&indices[0], len, (uint)n);
+    }
+};
+
+///////////////////////////////////////////////////////////////////////////////
+DatasetFilter::DatasetFilter():
+    myNumDimensions(0),
+    myRangeStamp(0),
+    myResultRangeStamp(0)
+{
+    myUpdater.start(1);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+DatasetFilter::~DatasetFilter()
+{
+    myUpdater.stop();
+}
+
+///////////////////////////////////////////////////////////////////////////////
+DatasetFilter::DomainKey DatasetFilter::makeKey(const Domain& d)
+{
+    DomainKey k = { d.start, d.length, d.decimation };
+    return k;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+bool DatasetFilter::isStale(const DomainResult& r)
+{
+    for(int i = 0; i < r.numFields; i++)
+    {
+        if(!r.fields[i]->loaded || r.fields[i]->version != r.versions[i]) return true;
+    }
+    return false;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+void DatasetFilter::setDimension(uint index, Dimension* d)
+{
+    if(d == NULL || index >= MaxDimensions) return;
+
+    myLock.lock();
+    myDimension[index] = d;
+    myMin[index] = d->floatRangeMin;
+    myMax[index] = d->floatRangeMax;
+
+    // Count the number of consecutive valid dimensions.
+    myNumDimensions = 0;
+    while(myNumDimensions < MaxDimensions && myDimension[myNumDimensions] != NULL) myNumDimensions++;
+    myLock.unlock();
+
+    rangeChanged();
+}
+
+///////////////////////////////////////////////////////////////////////////////
+void DatasetFilter::setRange(uint index, float fmin, float fmax)
+{
+    myLock.lock();
+    myMin[index] = fmin;
+    myMax[index] = fmax;
+    myLock.unlock();
+    rangeChanged();
+}
+
+///////////////////////////////////////////////////////////////////////////////
+void DatasetFilter::setNormalizedRange(uint index, float fmin, float fmax)
+{
+    Dimension* d = myDimension[index];
+    float fm = d->floatRangeMin;
+    float delta = d->floatRangeMax - fm;
+    setRange(index, fm + delta * fmin, fm + delta * fmax);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+void DatasetFilter::rangeChanged()
+{
+    myLock.lock();
+    myRangeStamp = otimestamp();
+    myLock.unlock();
+    myUpdater.clearQueue();
+    myUpdater.queue(this);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+bool DatasetFilter::getResult(const Domain& d, Ref<Bitmap>& result, double* stamp)
+{
+    AutoLock al(myLock);
+    DomainKey k = makeKey(d);
+    ResultMap::iterator it = myResults.find(k);
+    if(it != myResults.end())
+    {
+        // Results of data that changed since they were computed are dropped,
+        // and the domain is evaluated again.
+        if(!isStale(it->second))
+        {
+            result = it->second.result;
+            *stamp = it->second.stamp;
+            return true;
+        }
+        myResults.erase(it);
+    }
+    myRequests[k] = d;
+    return false;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+void DatasetFilter::update()
+{
+    myLock.lock();
+    bool pending = !myRequests.empty();
+    myLock.unlock();
+    if(pending)
+    {
+        myUpdater.clearQueue();
+        myUpdater.queue(this);
+    }
+}
+
+///////////////////////////////////////////////////////////////////////////////
+void DatasetFilter::execute(WorkerTask::TaskInfo* ti)
+{
+    // Take a snapshot of the filter state.
+    myLock.lock();
+    int nd = myNumDimensions;
+    Ref<Dimension> dims[MaxDimensions];
+    DomainFilterTask task;
+    for(int i = 0; i < nd; i++)
+    {
+        dims[i] = myDimension[i];
+        task.vmin[i] = myMin[i];
+        task.vmax[i] = myMax[i];
+    }
+    double rangeStamp = myRangeStamp;
+    // When the ranges changed, all resident domains are evaluated again.
+    bool all = myResultRangeStamp < rangeStamp;
+    std::map<DomainKey, Domain> requests;
+    requests.swap(myRequests);
+    myLock.unlock();
+
+    if(nd == 0) return;
+    Dataset* ds = dims[0]->dataset;
+
+    std::map<DomainKey, Domain> domains;
+    if(all)
+    {
+        Vector<Field*> fields;
+        ds->getFields(dims[0], fields);
+        foreach(Field* f, fields)
+        {
+            if(f->loaded) domains[makeKey(f->domain)] = f->domain;
+        }
+    }
+
+    // Pin the fields of each domain while we filter them. Requested domains
+    // with fields that are not loaded get their fields loaded, and stay
+    // requested.
+    Vector<DomainJob> jobs;
+    std::map<DomainKey, Domain> unready;
+    typedef std::pair<const DomainKey, Domain> DomainItem;
+    foreach(DomainItem& di, requests) domains[di.first] = di.second;
+    foreach(DomainItem& di, domains)
+    {
+        DomainJob job;
+        job.domain = di.second;
+        bool ready = true;
+        for(int i = 0; i < nd; i++)
+        {
+            Field* f = ds->getOrCreateField(dims[i], di.second);
+            f->pin();
+            job.fields[i] = f;
+            job.versions[i] = f->version;
+            if(!f->loaded)
+            {
+                ready = false;
+                if(requests.find(di.first) != requests.end()) ds->load(f);
+            }
+        }
+        if(ready)
+        {
+            jobs.push_back(job);
+        }
+        else
+        {
+            for(int i = 0; i < nd; i++) job.fields[i]->unpin();
+            if(requests.find(di.first) != requests.end()) unready[di.first] = di.second;
+        }
+    }
+
+    task.jobs = &jobs;
+    task.numDimensions = nd;
+    ComputePool::instance()->parallelFor(&task, jobs.size());
+
+    foreach(DomainJob& job, jobs)
+    {
+        for(int i = 0; i < nd; i++) job.fields[i]->unpin();
+    }
+
+    myLock.lock();
+    // Domains still waiting for data are evaluated on a later update.
+    foreach(DomainItem& di, unready) myRequests[di.first] = di.second;
+
+    // If the ranges changed while filtering, the results are stale. A new
+    // evaluation is already queued.
+    if(myRangeStamp > rangeStamp)
+    {
+        foreach(DomainItem& di, requests) myRequests[di.first] = di.second;
+        myLock.unlock();
+        return;
+    }
+
+    // Results of the previous ranges for domains that are not resident
+    // anymore are dropped: they get requested again when drawn.
+    // Results of domains whose data changed or was evicted are dropped too.
+    if(all)
+    {
+        myResults.clear();
+        myResultRangeStamp = rangeStamp;
+    }
+    else
+    {
+        ResultMap::iterator it = myResults.begin();
+        while(it != myResults.end())
+        {
+            if(isStale(it->second)) myResults.erase(it++);
+            else ++it;
+        }
+    }
+    double now = otimestamp();
+    foreach(DomainJob& job, jobs)
+    {
+        DomainResult& r = myResults[makeKey(job.domain)];
+        r.result = job.result;
+        r.stamp = now;
+        r.numFields = nd;
+        for(int i = 0; i < nd; i++)
+        {
+            r.fields[i] = job.fields[i];
+            r.versions[i] = job.versions[i];
+        }
+    }
+    myLock.unlock();
+}
@@ -0,0 +1,91 @@
+#ifndef __DATASET_FILTER__
+#define __DATASET_FILTER__
+
+#include <omega.h>
+#include "Dataset.h"
+#include "Bitmap.h"
+
+using namespace omega;
+
+///////////////////////////////////////////////////////////////////////////////
+//! Range filter over dimensions of a dataset. Unlike Filter, which works on
+//! a single field, a dataset filter evaluates every resident domain of its
+//! dimensions (i.e. all the loaded batches of a point cloud) in parallel, and
+//! publishes a separate result for each domain.
+//! Domains that are requested but have no result yet get their fields loaded
+//! and are evaluated when the data is ready.
+class DatasetFilter : public WorkerTask
+{
+public:
+    static const int MaxDimensions = 4;
+
+    DatasetFilter();
+    ~DatasetFilter();
+
+    void setDimension(uint index, Dimension* d);
+    void setRange(uint index, float fmin, float fmax);
+    void setNormalizedRange(uint index, float fmin, float fmax);
+
+    //! Gets the result for a domain: the indices of the selected domain
+    //! elements, and the time it was computed. Returns false if the domain
+    //! has no result yet. The domain is then queued for evaluation.
+    bool getResult(const Domain& d, Ref<Bitmap>& result, double* stamp);
+    //! Returns true if the filter has dimensions. Filters without dimensions
+    //! select everything.
+    bool isEnabled() { return myNumDimensions > 0; }
+
+    //! Queues evaluation of requested domains. Call once per frame.
+    void update();
+    void execute(WorkerTask::TaskInfo* ti);
+
+private:
+    struct DomainKey
+    {
+        size_t start;
+        size_t length;
+        int decimation;
+
+        bool operator<(const DomainKey& rhs) const
+        {
+            if(start != rhs.start) return start < rhs.start;
+            if(length != rhs.length) return length < rhs.length;
+            return decimation < rhs.decimation;
+        }
+    };
+
+    struct DomainResult
+    {
+        Ref<Bitmap> result;
+        double stamp;
+        // Fields the result was computed from, and their versions. Keeps the
+        // fields alive while the result exists.
+        Ref<Field> fields[MaxDimensions];
+        uint versions[MaxDimensions];
+        int numFields;
+    };
+
+    typedef std::map<DomainKey, DomainResult> ResultMap;
+
+    static DomainKey makeKey(const Domain& d);
+    //! Returns true if the data of a result field changed or was evicted.
+    static bool isStale(const DomainResult& r);
+    void rangeChanged();
+
+private:
+    WorkerPool myUpdater;
+    Lock myLock;
+
+    Ref<Dimension> myDimension[MaxDimensions];
+    float myMin[MaxDimensions];
+    float myMax[MaxDimensions];
+    int myNumDimensions;
+    double myRangeStamp;
+
+    ResultMap myResults;
+    // Time of the range change the results were computed for.
+    double myResultRangeStamp;
+    // Domains requested by getResult that have no result yet.
+    std::map<DomainKey, Domain> myRequests;
+};
+
+#endif
@@ -0,0 +1,303 @@
+#include "FieldAllocator.h"
+
+#ifdef OMEGA_OS_WIN
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#endif
+
+#include <map>
+
+// Smallest block size.
+#define MIN_BLOCK_SHIFT 16
+// Number of power of two size classes. The largest class is 1GB, bigger
+// buffers are mapped directly.
+#define NUM_SIZE_CLASSES 15
+// Slab size. Classes smaller than this are carved out of slabs, and large
+// mappings are rounded to this size. Matches the x86 huge page size.
+#define SLAB_SIZE (2 * 1024 * 1024)
+// Default maximum bytes of freed blocks kept for reuse.
+#define DEFAULT_MAX_RETAINED (256 * 1024 * 1024)
+
+///////////////////////////////////////////////////////////////////////////////
+// Block metadata. It is kept out of the blocks, in a map indexed by block
+// address: an in-band header would push power of two buffers into the next
+// size class. Blocks start on page boundaries (slabs and mappings are page
+// aligned, and block sizes are multiples of the page size), so they are 
+// aligned as well.
+struct BlockInfo
+{
+    // Size class, or -1 for blocks mapped directly.
+    int sizeClass;
+    size_t blockSize;
+    // Set when the block pages were given back to the OS. Released blocks
+    // do not count as retained memory.
+    bool released;
+};
+
+///////////////////////////////////////////////////////////////////////////////
+// Maps zeroed pages from the OS. bytes is a multiple of SLAB_SIZE. On Linux
+// the mapping starts on a SLAB_SIZE boundary, so it can be backed by 
+// transparent huge pages.
+static void* mapPages(size_t bytes)
+{
+#ifdef OMEGA_OS_WIN
+    return VirtualAlloc(NULL, bytes, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE);
+#else
+    // mmap only aligns to the page size: map an extra slab and unmap what is
+    // before and after the aligned range.
+    size_t mapped = bytes + SLAB_SIZE;
+    void* m = mmap(NULL, mapped, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if(m == MAP_FAILED) return NULL;
+    char* start = (char*)m;
+    char* p = (char*)(((uintptr_t)start + SLAB_SIZE - 1) / SLAB_SIZE * SLAB_SIZE);
+    size_t head = p - start;
+    size_t tail = mapped - head - bytes;
+    if(head > 0) munmap(start, head);
+    if(tail > 0) munmap(p + bytes, tail);
+#ifdef MADV_HUGEPAGE
+    madvise(p, bytes, MADV_HUGEPAGE);
+#endif
+    return p;
+#endif
+}
+
+///////////////////////////////////////////////////////////////////////////////
+static void unmapPages(void* p, size_t bytes)
+{
+#ifdef OMEGA_OS_WIN
+    VirtualFree(p, 0, MEM_RELEASE);
+#else
+    munmap(p, bytes);
+#endif
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Gives the physical memory of a range back to the OS, keeping the range
+// mapped so it can be reused.
+static void releasePages(void* p, size_t bytes)
+{
+#ifdef OMEGA_OS_WIN
+    VirtualAlloc(p, bytes, MEM_RESET, PAGE_READWRITE);
+#else
+    madvise(p, bytes, MADV_DONTNEED);
+#endif
+}
+
+///////////////////////////////////////////////////////////////////////////////
+class FieldAllocatorImpl
+{
+public:
+    FieldAllocatorImpl():
+        myMaxRetained(DEFAULT_MAX_RETAINED),
+        myRetained(0),
+        myAllocated(0)
+    {}
+
+    void* allocate(size_t bytes);
+    void free(void* p);
+    //! Returns the metadata of a block. Called with the lock held.
+    BlockInfo& getInfo(void* p);
+
+    Lock lock;
+    size_t myMaxRetained;
+    size_t myRetained;
+    size_t myAllocated;
+
+private:
+    bool refillSlab(int sizeClass);
+    void addBlock(char* block, int sizeClass, size_t blockSize);
+
+    // Metadata of all blocks, allocated or free.
+    std::map<char*, BlockInfo> myBlocks;
+    // Free blocks for each size class.
+    Vector<char*> myFreeBlocks[NUM_SIZE_CLASSES];
+};
+
+static FieldAllocatorImpl sAllocator;
+
+///////////////////////////////////////////////////////////////////////////////
+static size_t classBlockSize(int sizeClass)
+{
+    return (size_t)1 << (MIN_BLOCK_SHIFT + sizeClass);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+BlockInfo& FieldAllocatorImpl::getInfo(void* p)
+{
+    std::map<char*, BlockInfo>::iterator it = myBlocks.find((char*)p);
+    oassert(it != myBlocks.end());
+    return it->second;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+void FieldAllocatorImpl::addBlock(char* block, int sizeClass, size_t blockSize)
+{
+    BlockInfo& bi = myBlocks[block];
+    bi.sizeClass = sizeClass;
+    bi.blockSize = blockSize;
+    bi.released = false;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+bool FieldAllocatorImpl::refillSlab(int sizeClass)
+{
+    // Carve a new slab into blocks of this size class.
+    size_t bs = classBlockSize(sizeClass);
+    char* slab = (char*)mapPages(SLAB_SIZE);
+    if(slab == NULL) return false;
+    for(size_t offs = 0; offs < SLAB_SIZE; offs += bs)
+    {
+        addBlock(slab + offs, sizeClass, bs);
+        myFreeBlocks[sizeClass].push_back(slab + offs);
+    }
+    myRetained += SLAB_SIZE;
+    return true;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+void* FieldAllocatorImpl::allocate(size_t bytes)
+{
+    // Find the size class
+    int sizeClass = 0;
+    while(sizeClass < NUM_SIZE_CLASSES && classBlockSize(sizeClass) < bytes) sizeClass++;
+
+    char* block = NULL;
+    size_t bs = 0;
+    if(sizeClass == NUM_SIZE_CLASSES)
+    {
+        // Too big for any class: map it directly.
+        bs = (bytes + SLAB_SIZE - 1) / SLAB_SIZE * SLAB_SIZE;
+        block = (char*)mapPages(bs);
+        if(block == NULL) return NULL;
+
+        AutoLock al(lock);
+        addBlock(block, -1, bs);
+    }
+    else
+    {
+        AutoLock al(lock);
+        Vector<char*>& fl = myFreeBlocks[sizeClass];
+        if(fl.empty())
+        {
+            size_t cbs = classBlockSize(sizeClass);
+            if(cbs < SLAB_SIZE)
+            {
+                if(!refillSlab(sizeClass)) return NULL;
+            }
+            else
+            {
+                char* nb = (char*)mapPages(cbs);
+                if(nb == NULL) return NULL;
+                addBlock(nb, sizeClass, cbs);
+                fl.push_back(nb);
+                myRetained += cbs;
+            }
+        }
+        block = fl.back();
+        fl.pop_back();
+        BlockInfo& bi = getInfo(block);
+        bs = bi.blockSize;
+        if(bi.released) bi.released = false;
+        else myRetained -= bs;
+    }
+
+    AutoLock al(lock);
+    myAllocated += bs;
+    return block;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+void FieldAllocatorImpl::free(void* p)
+{
+    char* block = (char*)p;
+
+    AutoLock al(lock);
+    BlockInfo& bi = getInfo(block);
+    size_t bs = bi.blockSize;
+    myAllocated -= bs;
+    if(bi.sizeClass == -1)
+    {
+        myBlocks.erase(block);
+        unmapPages(block, bs);
+    }
+    else if(myRetained + bs <= myMaxRetained)
+    {
+        myFreeBlocks[bi.sizeClass].push_back(block);
+        myRetained += bs;
+    }
+    else if(bs >= SLAB_SIZE)
+    {
+        // Over the retention limit: large blocks are unmapped.
+        myBlocks.erase(block);
+        unmapPages(block, bs);
+    }
+    else
+    {
+        // Slab blocks can't be unmapped on their own. Keep the block, but
+        // give its pages back to the OS.
+        releasePages(block, bs);
+        bi.released = true;
+        myFreeBlocks[bi.sizeClass].push_back(block);
+    }
+}
+
+///////////////////////////////////////////////////////////////////////////////
+void* FieldAllocator::allocate(size_t bytes)
+{
+    void* p = sAllocator.allocate(bytes);
+    if(p == NULL)
+    {
+        oferror("[FieldAllocator::allocate] could not allocate %1% bytes", %bytes);
+    }
+    return p;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+void* FieldAllocator::reallocate(void* p, size_t bytes)
+{
+    if(p == NULL) return allocate(bytes);
+
+    size_t capacity = getCapacity(p);
+    if(bytes <= capacity) return p;
+
+    void* np = allocate(bytes);
+    if(np == NULL) return NULL;
+    memcpy(np, p, capacity);
+    free(p);
+    return np;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+void FieldAllocator::free(void* p)
+{
+    if(p != NULL) sAllocator.free(p);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+size_t FieldAllocator::getCapacity(void* p)
+{
+    AutoLock al(sAllocator.lock);
+    return sAllocator.getInfo(p).blockSize;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+void FieldAllocator::setMaxRetainedBytes(size_t bytes)
+{
+    AutoLock al(sAllocator.lock);
+    sAllocator.myMaxRetained = bytes;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+size_t FieldAllocator::getRetainedBytes()
+{
+    AutoLock al(sAllocator.lock);
+    return sAllocator.myRetained;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+size_t FieldAllocator::getAllocatedBytes()
+{
+    AutoLock al(sAllocator.lock);
+    return sAllocator.myAllocated;
+}
@@ -0,0 +1,39 @@
+#ifndef __FIELD_ALLOCATOR__
+#define __FIELD_ALLOCATOR__
+
+#include <omega.h>
+
+using namespace omega;
+
+///////////////////////////////////////////////////////////////////////////////
+//! Allocator for field data buffers. All field data is allocated and freed
+//! through it.
+//! Buffers are rounded up to power of two size classes. Small classes are
+//! carved out of 2MB slabs, large ones get their own mapping. Memory comes
+//! from the OS page allocator (with transparent huge pages where available)
+//! instead of the heap, so many batch sized buffers do not fragment it. Freed
+//! buffers are kept for reuse up to a retention limit; past it their pages
+//! are given back to the OS. Block sizes are kept out of the blocks, so 
+//! power of two buffers fill their size class exactly.
+//! Buffers are aligned to FieldAllocator::Alignment bytes.
+class FieldAllocator
+{
+public:
+    static const size_t Alignment = 64;
+
+    static void* allocate(size_t bytes);
+    //! Grows a buffer, keeping its content. Returns the same buffer if its
+    //! size class is large enough.
+    static void* reallocate(void* p, size_t bytes);
+    static void free(void* p);
+    //! Returns the number of usable bytes in a buffer.
+    static size_t getCapacity(void* p);
+
+    //! Sets the maximum number of bytes of freed buffers kept for reuse.
+    static void setMaxRetainedBytes(size_t bytes);
+    static size_t getRetainedBytes();
+    //! Total bytes of buffers currently allocated.
+    static size_t getAllocatedBytes();
+};
+
+#endif
@@ -0,0 +1,147 @@
+#include "FieldCache.h"
+#include "FieldAllocator.h"
+
+#include <set>
+
+// Fields used within this many frames are never evicted. This avoids
+// thrashing when the working set of a frame does not fit the budget.
+#define MIN_EVICT_AGE 30
+
+FieldCache* FieldCache::mysInstance = NULL;
+
+///////////////////////////////////////////////////////////////////////////////
+struct EvictCandidate
+{
+    Field* field;
+    uint lastUsed;
+
+    bool operator<(const EvictCandidate& rhs) const
+    {
+        return lastUsed < rhs.lastUsed;
+    }
+};
+
+///////////////////////////////////////////////////////////////////////////////
+FieldCache* FieldCache::instance()
+{
+    if(mysInstance == NULL) mysInstance = new FieldCache();
+    return mysInstance;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+FieldCache::FieldCache():
+    myBudget(0),
+    myUsedBytes(0),
+    myFrame(0)
+{
+}
+
+///////////////////////////////////////////////////////////////////////////////
+void FieldCache::setBudget(size_t bytes)
+{
+    AutoLock al(myLock);
+    myBudget = bytes;
+    evict();
+}
+
+///////////////////////////////////////////////////////////////////////////////
+void FieldCache::add(Field* f)
+{
+    AutoLock al(myLock);
+    f->lastUsed = myFrame;
+    // Charge the memory the allocator reserved for the data, which can be
+    // larger than the data itself.
+    f->lock.lock();
+    f->cachedBytes = f->data != NULL ? FieldAllocator::getCapacity(f->data) : 0;
+    f->lock.unlock();
+    myUsedBytes += f->cachedBytes;
+    myFields.push_back(f);
+    evict();
+}
+
+///////////////////////////////////////////////////////////////////////////////
+void FieldCache::evict()
+{
+    if(myBudget == 0 || myUsedBytes <= myBudget) return;
+
+    // Collect the fields we can evict, oldest first.
+    Vector<EvictCandidate> candidates;
+    foreach(Field* f, myFields)
+    {
+        if(myFrame - f->lastUsed > MIN_EVICT_AGE)
+        {
+            EvictCandidate c = { f, f->lastUsed };
+            candidates.push_back(c);
+        }
+    }
+    std::sort(candidates.begin(), candidates.end());
+
+    std::set<Field*> evicted;
+    foreach(EvictCandidate& c, candidates)
+    {
+        if(myUsedBytes <= myBudget) break;
+
+        Field* f = c.field;
+        f->lock.lock();
+        // Pinned fields are in use by a filter or loader, skip them.
+        if(f->isPinned())
+        {
+            f->lock.unlock();
+            continue;
+        }
+        if(f->data != NULL)
+        {
+            FieldAllocator::free(f->data);
+            f->data = NULL;
+        }
+        f->loaded = false;
+        f->dataChanged();
+        f->lock.unlock();
+
+        myUsedBytes -= f->cachedBytes;
+        f->cachedBytes = 0;
+        evicted.insert(f);
+        // Render threads release the field gpu buffers in their next frame.
+        for(size_t i = 0; i < myGpuReleases.size(); i++)
+        {
+            myGpuReleases[i].push_back(f);
+        }
+        //ofmsg("[FieldCache::evict] %1%", %f->getName());
+    }
+
+    // Drop the evicted fields in one pass over the field list.
+    if(!evicted.empty())
+    {
+        List< Ref<Field> > fields;
+        foreach(Field* f, myFields)
+        {
+            if(evicted.find(f) == evicted.end()) fields.push_back(f);
+        }
+        myFields.swap(fields);
+    }
+
+    if(myUsedBytes > myBudget)
+    {
+        oflog(Debug, "[FieldCache::evict] over budget: %1% bytes used, %2% budget",
+            %myUsedBytes %myBudget);
+    }
+}
+
+///////////////////////////////////////////////////////////////////////////////
+void FieldCache::addGpuContext(uint ctx)
+{
+    AutoLock al(myLock);
+    if(ctx >= myGpuReleases.size()) myGpuReleases.resize(ctx + 1);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+void FieldCache::releaseGpuBuffers(const DrawContext& dc)
+{
+    uint ctx = dc.gpuContext->getId();
+    List< Ref<Field> > fields;
+    myLock.lock();
+    if(ctx < myGpuReleases.size()) fields.swap(myGpuReleases[ctx]);
+    myLock.unlock();
+
+    foreach(Field* f, fields) f->releaseGpuBuffer(dc);
+}
@@ -0,0 +1,57 @@
+#ifndef __FIELD_CACHE__
+#define __FIELD_CACHE__
+
+#include <omega.h>
+#include "Dataset.h"
+
+using namespace omega;
+
+///////////////////////////////////////////////////////////////////////////////
+//! Keeps track of the host memory used by loaded fields. When the memory
+//! budget is exceeded, the data of the least recently used fields is freed.
+//! Evicted fields get loaded again on demand through Dataset::load. Their gpu
+//! buffers are released by each render thread at the start of its next frame.
+class FieldCache
+{
+public:
+    static FieldCache* instance();
+
+    //! Sets the host memory budget in bytes. 0 means no limit.
+    void setBudget(size_t bytes);
+    size_t getBudget() { return myBudget; }
+    size_t getUsedBytes() { return myUsedBytes; }
+
+    //! Advances the cache clock. Called once per frame.
+    void beginFrame() { myFrame++; }
+    uint getFrame() { return myFrame; }
+    //! Marks a field as used in the current frame.
+    void touch(Field* f) { f->lastUsed = myFrame; }
+
+    //! Adds a newly loaded field to the cache. Evicts other fields if the
+    //! memory budget is exceeded.
+    void add(Field* f);
+
+    //! Registers a gpu context that holds field buffers. Fields evicted from
+    //! now on get their buffers released in this context.
+    void addGpuContext(uint ctx);
+    //! Releases the gpu buffers of the fields evicted since the last call in
+    //! this context. Called by render threads at the start of a frame.
+    void releaseGpuBuffers(const DrawContext& dc);
+
+private:
+    FieldCache();
+    void evict();
+
+private:
+    static FieldCache* mysInstance;
+
+    Lock myLock;
+    List< Ref<Field> > myFields;
+    // Evicted fields whose gpu buffers are not released yet, by context id.
+    Vector< List< Ref<Field> > > myGpuReleases;
+    size_t myBudget;
+    size_t myUsedBytes;
+    uint myFrame;
+};
+
+#endif
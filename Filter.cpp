@@ -1,21 +1,105 @@
 #include "Dataset.h"
 #include "Filter.h"
+#include "FieldCache.h"
+#include "FilterKernel.h"
+#include "ComputePool.h"
+#include "FilterScan.h"
+#include "FilterCache.h"
+
+#include <algorithm>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+// Incremental filter updates are used when they test less than this 
+// fraction of the filter domain.
+#define MAX_REFINE_FRACTION 0.25
+// Sorted index queries are used when they test less than this fraction of
+// the filter domain. Their random accesses are slower than a scan.
+#define MAX_QUERY_FRACTION 0.05
+// Elements tested by incremental updates and index queries between checks for
+// range changes. Kept small so slider drags abandon stale work quickly.
+#define STALE_CHECK_INTERVAL 16384
+// Default time between partial results of full scans (seconds)
+#define PROGRESS_INTERVAL 0.1
+// Largest domain handled by incremental updates and index queries. Sorted
+// indices and element lists use 32 bit indices.
+#define MAX_INDEXED_LENGTH 0xffffffffULL
+
+///////////////////////////////////////////////////////////////////////////////
+// Atomic operations with full memory barriers.
+static inline int atomicAdd(volatile int* p, int v)
+{
+#ifdef _MSC_VER
+    return _InterlockedExchangeAdd((volatile long*)p, v) + v;
+#else
+    return __sync_add_and_fetch(p, v);
+#endif
+}
+
+///////////////////////////////////////////////////////////////////////////////
+static inline int atomicLoad(volatile int* p)
+{
+#ifdef _MSC_VER
+    return _InterlockedCompareExchange((volatile long*)p, 0, 0);
+#else
+    return __sync_fetch_and_add(p, 0);
+#endif
+}
+
+///////////////////////////////////////////////////////////////////////////////
+static inline void atomicStore(volatile int* p, int v)
+{
+#ifdef _MSC_VER
+    _InterlockedExchange((volatile long*)p, v);
+#else
+    __sync_lock_test_and_set(p, v);
+    __sync_synchronize();
+#endif
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Returns the result cache key of ranges over fields.
+static FilterCache::Key makeCacheKey(int numFields, Field* const* fields, 
+    const float* vmin, const float* vmax)
+{
+    FilterCache::Key k;
+    k.numFields = numFields;
+    for(int j = 0; j < numFields; j++)
+    {
+        k.fields[j] = fields[j];
+        k.versions[j] = fields[j]->version;
+        k.min[j] = vmin[j];
+        k.max[j] = vmax[j];
+    }
+    return k;
+}
 
 ///////////////////////////////////////////////////////////////////////////////
 Filter::Filter() :
-myRangeStamp(0),
-myIndexStamp(0),
+myCurrentSlot(0),
+myOperation(Range),
+myOperandStamp(0),
+myProgressInterval(PROGRESS_INTERVAL),
+myProgressStamp(0),
+myPartialPublishers(0),
 myNumFields(0),
-myIndices(NULL),
-myIndexLen(-1)
+myResultNumFields(0),
+myGeneration(0),
+myIndexStamp(0)
 {
     memset(myField, 0, sizeof(myField));
+    memset(myResultField, 0, sizeof(myResultField));
+    mySlotReaders[0] = 0;
+    mySlotReaders[1] = 0;
+    memset(myIndexLength, 0, sizeof(myIndexLength));
     myUpdater.start(1);
 }
 
 ///////////////////////////////////////////////////////////////////////////////
 Filter::~Filter()
 {
+    foreach(Dataset* ds, myLoadSources) ds->removeLoadListener(this);
     myUpdater.stop();
 }
 
@@ -24,6 +108,15 @@ Filter::~Filter()
 void Filter::setField(uint index, Field* f)
 {
     if(f != NULL) {
+        // Setting fields turns set operation filters back to range filters.
+        if(myOperation != Range)
+        {
+            myLock.lock();
+            myOperation = Range;
+            myOperand[0] = NULL;
+            myOperand[1] = NULL;
+            myLock.unlock();
+        }
         myField[index] = f;
         myMin[index] = f->getDimension()->floatRangeMin;
         myMax[index] = f->getDimension()->floatRangeMax;
@@ -39,9 +132,7 @@ void Filter::setRange(uint index, float fmin, float fmax)
 {
     myMin[index] = fmin;
     myMax[index] = fmax;
-    myRangeStamp = otimestamp();
-    myUpdater.clearQueue();
-    myUpdater.queue(this);
+    rangeChanged();
 }
 
 ///////////////////////////////////////////////////////////////////////////////
@@ -52,77 +143,585 @@ void Filter::setNormalizedRange(uint index, float fmin, float fmax)
     float delta = fM - fm;
     myMin[index] = fm + delta * fmin;
     myMax[index] = fm + delta * fmax;
-    myRangeStamp = otimestamp();
+    rangeChanged();
+}
+
+///////////////////////////////////////////////////////////////////////////////
+void Filter::rangeChanged()
+{
+    // Running passes see the new generation at their next check and exit.
+    atomicAdd(&myGeneration, 1);
     myUpdater.clearQueue();
     myUpdater.queue(this);
 }
 
 ///////////////////////////////////////////////////////////////////////////////
-template<typename T> 
-void Filter::filterKernel(double timestamp)
+bool Filter::isStale(int generation)
 {
+    return atomicLoad(&myGeneration) != generation;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+bool Filter::filterRange(uint64_t start, uint64_t end, uint* out, uint* count, int generation)
+{
+    // Filter the columns from the chunk start, so indices are chunk-local.
+    size_t elementSize = Dataset::useDoublePrecision() ? sizeof(double) : sizeof(float);
+    const void* columns[MaxFields];
+    for(int j = 0; j < myNumFields; j++)
+    {
+        columns[j] = (const char*)myColumns[j] + start * elementSize;
+    }
+
+    uint len = 0;
+    for(uint64_t zs = start; zs < end; zs += Field::ZoneSize)
+    {
+        // if the filter range changed, we are processing stale data. exit now.
+        if(isStale(generation)) return false;
+
+        uint64_t ze = min(zs + Field::ZoneSize, end);
+
+        // Use the field zone maps to skip zones where no element passes, and
+        // to accept zones where all elements pass without testing them.
+        size_t z = (size_t)(zs / Field::ZoneSize);
+        bool all = true;
+        bool none = false;
+        for(uint j = 0; j < myNumFields; j++)
+        {
+            Field* f = myField[j];
+            if(z >= f->getNumZones())
+            {
+                all = false;
+                continue;
+            }
+            const Field::Zone& zn = f->getZone(z);
+            // NaN values always pass, so zones containing them are never 
+            // skipped.
+            if(!zn.hasNaN && (zn.max < myRunMin[j] || zn.min > myRunMax[j]))
+            {
+                none = true;
+                break;
+            }
+            if(zn.min < myRunMin[j] || zn.max > myRunMax[j]) all = false;
+        }
+        if(none) continue;
+
+        uint ls = (uint)(zs - start);
+        uint le = (uint)(ze - start);
+        if(all)
+        {
+            for(uint i = ls; i < le; i++) out[len++] = i;
+            continue;
+        }
+
+        len += FilterKernel::run(columns, myNumFields, Dataset::useDoublePrecision(),
+            myRunMin, myRunMax, ls, le, out + len);
+    }
+    *count = len;
+    return true;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+void Filter::filterKernel(int generation)
+{
+    uint64_t sz = myField[0]->domain.length;
+
+    // Filter chunks in parallel, each into its own scratch region. The scan
+    // is shared with other filters scanning at the same time. The scratch 
+    // buffer only lives for the scan: it holds an index per element.
+    size_t numChunks = (size_t)((sz + FilterScan::ChunkSize - 1) / FilterScan::ChunkSize);
+    Vector<uint> scratch(numChunks * (FilterScan::ChunkSize + FilterKernel::OutputPadding));
+    Vector<uint> counts(numChunks);
+    myChunkDone.assign(numChunks, 0);
+    myProgressStamp = otimestamp();
+
+    FilterScan::Request scan;
+    scan.filter = this;
+    scan.generation = generation;
+    scan.key = myColumns[0];
+    scan.size = sz;
+    scan.scratch = numChunks > 0 ? &scratch[0] : NULL;
+    scan.counts = numChunks > 0 ? &counts[0] : NULL;
+    FilterScan::instance()->scan(&scan);
+    if(scan.stale || isStale(generation)) return;
+
+    // Chunk indices are local: add them to the result with the chunk start.
+    Ref<Bitmap> result = new Bitmap(sz);
+    for(size_t c = 0; c < numChunks; c++)
+    {
+        uint* src = scan.scratch + c * (FilterScan::ChunkSize + FilterKernel::OutputPadding);
+        result->append((uint64_t)c * FilterScan::ChunkSize, src, counts[c]);
+    }
+    publish(result);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+template<typename T>
+bool Filter::passes(uint i)
+{
+    bool pass = true;
+    for(int j = 0; j < myNumFields; j++)
+    {
+        T v = ((const T*)myColumns[j])[i];
+        pass &= !(v < myRunMin[j]) & !(v > myRunMax[j]);
+    }
+    return pass;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+SortedIndex* Filter::getSortedIndex(int j)
+{
+    Field* f = myField[j];
+    SortedIndex* idx = f->getSortedIndex();
+    if(idx == NULL)
+    {
+        // Share the index with other users of the field.
+        idx = SortedIndex::build(f);
+        f->setSortedIndex(idx);
+    }
+    mySortedIndex[j] = idx;
+    return idx;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+template<typename T>
+bool Filter::refine(int generation)
+{
+    // We need a previous result for the same fields.
+    Ref<Bitmap> prev = readResult();
+    if(prev == NULL || myResultNumFields != myNumFields) return false;
+    if(myField[0]->domain.length > MAX_INDEXED_LENGTH) return false;
+    for(int j = 0; j < myNumFields; j++)
+    {
+        if(myResultField[j] != myField[j] || 
+            myResultVersion[j] != myField[j]->version) return false;
+    }
+
+    // An element is in the new result if it passed the old ranges and passes
+    // the new ones, or if it is admitted by a widened range: its value is 
+    // inside the new range but outside the old one. Find the admitted value 
+    // bands in the field sorted indices.
+    struct Band { int field; size_t start; size_t end; };
+    Band bands[MaxFields * 2];
+    int numBands = 0;
+    size_t admitted = 0;
     uint sz = static_cast<uint>(myField[0]->domain.length);
-    uint* indices = (uint*)malloc(sz * sizeof(uint));
-    memset(indices, 0, sz * sizeof(uint));
+    for(int j = 0; j < myNumFields; j++)
+    {
+        float a = myResultMin[j];
+        float b = myResultMax[j];
+        float c = myRunMin[j];
+        float d = myRunMax[j];
+        // Narrowed or unchanged range: nothing admitted.
+        if(c >= a && d <= b) continue;
+
+        SortedIndex* idx = getSortedIndex(j);
+        size_t lc, ud, la, ub;
+        idx->findRange(c, d, &lc, &ud);
+        idx->findRange(a, b, &la, &ub);
+        // Values in [c, a)
+        if(lc < min(la, ud))
+        {
+            Band bd = { j, lc, min(la, ud) };
+            bands[numBands++] = bd;
+            admitted += bd.end - bd.start;
+        }
+        // Values in (b, d]
+        if(max(ub, lc) < ud)
+        {
+            Band bd = { j, max(ub, lc), ud };
+            bands[numBands++] = bd;
+            admitted += bd.end - bd.start;
+        }
+    }
 
+    // Large changes are faster with a full parallel pass.
+    uint prevLen = (uint)prev->getCardinality();
+    if(prevLen + admitted > sz * MAX_REFINE_FRACTION) return false;
+
+    // Test previously passing elements against the new ranges.
+    uint* kept = (uint*)malloc((prevLen + 1) * sizeof(uint));
+    prev->toIndices(kept);
     uint len = 0;
-    for(uint i = 0; i < sz; i++)
+    for(uint k = 0; k < prevLen; k++)
     {
-        // if the filter stamp was updated, we are processing stale data. exit now.
-        if(myRangeStamp > timestamp)
+        // if the filter range changed, we are processing stale data. exit now.
+        if(k % STALE_CHECK_INTERVAL == 0 && isStale(generation))
         {
-            free(indices);
-            return;
+            free(kept);
+            return true;
         }
+        uint i = kept[k];
+        kept[len] = i;
+        len += passes<T>(i);
+    }
 
-        bool pass = true;
-        for(uint j = 0; j < myNumFields; j++)
+    // Test admitted elements.
+    Vector<uint> added;
+    for(int k = 0; k < numBands; k++)
+    {
+        const uint* order = mySortedIndex[bands[k].field]->getOrder();
+        for(size_t p = bands[k].start; p < bands[k].end; p++)
         {
-            T* d = (T*)myField[j]->data;
-            if(d[i] < myMin[j] || d[i] > myMax[j])
+            if((p - bands[k].start) % STALE_CHECK_INTERVAL == 0 && isStale(generation))
             {
-                pass = false;
-                break;
+                free(kept);
+                return true;
             }
+            if(passes<T>(order[p])) added.push_back(order[p]);
+        }
+    }
+    // Elements can be admitted by more than one widened range.
+    std::sort(added.begin(), added.end());
+    added.erase(std::unique(added.begin(), added.end()), added.end());
+
+    uint* indices = (uint*)malloc((len + added.size() + 1) * sizeof(uint));
+    std::merge(kept, kept + len, added.begin(), added.end(), indices);
+    free(kept);
+
+    if(isStale(generation))
+    {
+        free(indices);
+        return true;
+    }
+    Ref<Bitmap> result = Bitmap::fromSorted(indices, len + (uint)added.size(), sz);
+    free(indices);
+    publish(result);
+    return true;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+template<typename T>
+bool Filter::query(int generation)
+{
+    if(myField[0]->domain.length > MAX_INDEXED_LENGTH) return false;
+    uint sz = static_cast<uint>(myField[0]->domain.length);
+
+    // Find the field with the fewest elements in range. NaN elements always
+    // pass, so they are candidates too.
+    int best = -1;
+    size_t bestFirst = 0;
+    size_t bestLast = 0;
+    size_t bestCount = 0;
+    for(int j = 0; j < myNumFields; j++)
+    {
+        SortedIndex* idx = myField[j]->getSortedIndex();
+        if(idx == NULL) return false;
+        mySortedIndex[j] = idx;
+
+        size_t first, last;
+        idx->findRange(myRunMin[j], myRunMax[j], &first, &last);
+        size_t count = last - first + idx->getNumElements() - idx->getNumValid();
+        if(best == -1 || count < bestCount)
+        {
+            best = j;
+            bestFirst = first;
+            bestLast = last;
+            bestCount = count;
         }
+    }
+    if(bestCount > sz * MAX_QUERY_FRACTION) return false;
 
-        if(pass)
+    // Test the candidates against the other ranges.
+    SortedIndex* idx = mySortedIndex[best];
+    const uint* order = idx->getOrder();
+    size_t numValid = idx->getNumValid();
+    size_t n = idx->getNumElements();
+    uint* indices = (uint*)malloc((bestCount + 1) * sizeof(uint));
+    uint len = 0;
+    for(size_t p = bestFirst; p < n; p++)
+    {
+        if(p == bestLast) p = numValid;
+        if(p == n) break;
+        // if the filter range changed, we are processing stale data. exit now.
+        if((p - bestFirst) % STALE_CHECK_INTERVAL == 0 && isStale(generation))
         {
-            indices[len] = i; len++;
+            free(indices);
+            return true;
         }
+        uint i = order[p];
+        indices[len] = i;
+        len += passes<T>(i);
     }
-    // Done filtering. copy the new indices over the old ones.
+    // Keep the result in element order.
+    std::sort(indices, indices + len);
+    if(isStale(generation))
+    {
+        free(indices);
+        return true;
+    }
+
+    Ref<Bitmap> result = Bitmap::fromSorted(indices, len, sz);
+    free(indices);
+    publish(result);
+    return true;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+void Filter::chunkScanned(FilterScan::Request* r, size_t chunk)
+{
+    atomicStore((volatile int*)&myChunkDone[chunk], 1);
+    if(myProgressInterval <= 0 || otimestamp() - myProgressStamp < myProgressInterval) return;
+
+    // One chunk task publishes, the others keep scanning.
+    if(atomicAdd(&myPartialPublishers, 1) != 1)
+    {
+        atomicAdd(&myPartialPublishers, -1);
+        return;
+    }
+    myProgressStamp = otimestamp();
+
+    // Collect the indices of the chunks done so far, in chunk order.
+    Ref<Bitmap> result = new Bitmap(r->size);
+    for(size_t c = 0; c < myChunkDone.size(); c++)
+    {
+        if(!atomicLoad((volatile int*)&myChunkDone[c])) continue;
+        uint* src = r->scratch + c * (FilterScan::ChunkSize + FilterKernel::OutputPadding);
+        result->append((uint64_t)c * FilterScan::ChunkSize, src, r->counts[c]);
+    }
+
+    if(!isStale(r->generation)) publish(result, false);
+    atomicAdd(&myPartialPublishers, -1);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+void Filter::publish(Bitmap* result, bool complete)
+{
+    // Remember what this result was computed for, so the next update can 
+    // refine it.
+    myResultNumFields = complete ? myNumFields : 0;
+    for(int j = 0; j < myNumFields; j++)
+    {
+        myResultField[j] = myField[j];
+        myResultVersion[j] = myField[j]->version;
+        myResultMin[j] = myRunMin[j];
+        myResultMax[j] = myRunMax[j];
+    }
+
+    if(complete)
+    {
+        FilterCache::instance()->add(
+            makeCacheKey(myNumFields, myField, myRunMin, myRunMax), result);
+    }
+
+    // Done filtering. replace the old result, unless the filter was turned
+    // into a set operation meanwhile.
+    myLock.lock();
+    if(myOperation == Range) writeResult(result);
+    myIndexStamp = otimestamp();
+    myLock.unlock();
+}
+
+///////////////////////////////////////////////////////////////////////////////
+Ref<Bitmap> Filter::readResult()
+{
+    // Register as a reader of the current slot. If a writer made the other
+    // slot current meanwhile, it may be refilling this one: try again.
+    int slot;
+    for(;;)
+    {
+        slot = atomicLoad(&myCurrentSlot);
+        atomicAdd(&mySlotReaders[slot], 1);
+        if(atomicLoad(&myCurrentSlot) == slot) break;
+        atomicAdd(&mySlotReaders[slot], -1);
+    }
+    Ref<Bitmap> result = myResultSlot[slot];
+    atomicAdd(&mySlotReaders[slot], -1);
+    return result;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+void Filter::writeResult(Bitmap* result)
+{
+    // Wait for readers still copying the result in the spare slot. They
+    // registered before the previous write, and only copy a reference.
+    int slot = 1 - atomicLoad(&myCurrentSlot);
+    while(atomicLoad(&mySlotReaders[slot]) != 0) osleep(0);
+    myResultSlot[slot] = result;
+    atomicStore(&myCurrentSlot, slot);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+void Filter::setOperation(Operation op, Filter* a, Filter* b)
+{
+    myUpdater.clearQueue();
     myLock.lock();
-    if(myIndices != NULL) free(myIndices);
-    myIndices = indices;
-    myIndexLen = len;
-    //ofmsg("index generated - length = %1%", %myIndexLen);
+    myOperation = op;
+    myOperand[0] = a;
+    myOperand[1] = b;
+    // Operands may not have a result yet: compute the set operation anyway.
+    myOperandStamp = -1;
+    writeResult(NULL);
     myIndexStamp = otimestamp();
     myLock.unlock();
+    myUpdater.queue(this);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+void Filter::setAnd(Filter* a, Filter* b)
+{
+    setOperation(And, a, b);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+void Filter::setOr(Filter* a, Filter* b)
+{
+    setOperation(Or, a, b);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+void Filter::setNot(Filter* a)
+{
+    setOperation(Not, a, NULL);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+double Filter::getIndexStamp()
+{
+    if(myOperation == Range) return myIndexStamp;
+    return max(myIndexStamp, getOperandStamp());
+}
+
+///////////////////////////////////////////////////////////////////////////////
+double Filter::getOperandStamp()
+{
+    double stamp = 0;
+    if(myOperand[0] != NULL) stamp = max(stamp, myOperand[0]->getIndexStamp());
+    if(myOperand[1] != NULL) stamp = max(stamp, myOperand[1]->getIndexStamp());
+    return stamp;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+Ref<Bitmap> Filter::getResult()
+{
+    // Set operation results are computed by the updater when an operand 
+    // changes. Until then, readers get the previous result.
+    if(myOperation != Range && getOperandStamp() > myOperandStamp)
+    {
+        myUpdater.clearQueue();
+        myUpdater.queue(this);
+    }
+    return readResult();
+}
+
+///////////////////////////////////////////////////////////////////////////////
+void Filter::updateSetOperation()
+{
+    AutoLock al(myLock);
+    if(myOperation == Range) return;
+    double stamp = getOperandStamp();
+    if(stamp <= myOperandStamp) return;
+    myOperandStamp = stamp;
+
+    // Operands that select everything (NULL results) act as full sets.
+    Ref<Bitmap> a = myOperand[0] != NULL ? myOperand[0]->getResult() : NULL;
+    Ref<Bitmap> b = myOperand[1] != NULL ? myOperand[1]->getResult() : NULL;
+    Ref<Bitmap> result;
+    switch(myOperation)
+    {
+    case And:
+        if(a == NULL) result = b;
+        else if(b == NULL) result = a;
+        else result = Bitmap::intersection(a, b);
+        break;
+    case Or:
+        if(a == NULL || b == NULL) result = NULL;
+        else result = Bitmap::unionOf(a, b);
+        break;
+    case Not:
+        if(a == NULL) result = Bitmap::fromSorted(NULL, 0, 0);
+        else result = Bitmap::complement(a);
+        break;
+    default:
+        break;
+    }
+    writeResult(result);
+    myIndexStamp = otimestamp();
+}
+
+///////////////////////////////////////////////////////////////////////////////
+uint64_t Filter::getFilteredLength()
+{
+    Ref<Bitmap> r = getResult();
+    if(r != NULL) return r->getCardinality();
+    return myNumFields > 0 ? myField[0]->domain.length : 0;
 }
 
 ///////////////////////////////////////////////////////////////////////////////
 void Filter::execute(WorkerTask::TaskInfo* ti)
 {
+    if(myOperation != Range)
+    {
+        updateSetOperation();
+        return;
+    }
     if(myNumFields == 0)
     {
-        myIndexLen = -1;
+        myLock.lock();
+        writeResult(NULL);
+        myLock.unlock();
         return;
     }
 
-    //double curStamp = myRangeStamp;
-    // If any field is not loaded, queue for loading and exit.
-    foreach(Field* f, myField)
+    // Pin the fields so the field cache does not evict them while we read
+    // them. If any field is not loaded, queue for loading and exit: loadDone
+    // runs the filter again when the load is done.
+    bool loaded = true;
+    for(int i = 0; i < myNumFields; i++)
+    {
+        Field* f = myField[i];
+        f->pin();
+        FieldCache::instance()->touch(f);
+        Dataset* ds = f->getDimension()->dataset;
+        if(!f->loaded && !ds->load(f, this))
+        {
+            loaded = false;
+            if(std::find(myLoadSources.begin(), myLoadSources.end(), ds) == myLoadSources.end())
+            {
+                myLoadSources.push_back(ds);
+            }
+        }
+    }
+
+    if(loaded)
     {
-        if(f != NULL && !f->loaded)
+        // Ranges set after this point bump the generation and abandon
+        // this pass.
+        int gen = atomicLoad(&myGeneration);
+        for(int j = 0; j < myNumFields; j++)
         {
-            f->getDimension()->dataset->load(f);
-            return;
+            myRunMin[j] = myMin[j];
+            myRunMax[j] = myMax[j];
+            myColumns[j] = myField[j]->data;
         }
+
+        // Results of recently used ranges are cached.
+        bool done = false;
+        Ref<Bitmap> cached = FilterCache::instance()->find(
+            makeCacheKey(myNumFields, myField, myRunMin, myRunMax));
+        if(cached != NULL)
+        {
+            publish(cached);
+            done = true;
+        }
+        else if(Dataset::useDoublePrecision()) done = refine<double>(gen) || query<double>(gen);
+        else done = refine<float>(gen) || query<float>(gen);
+        if(!done) filterKernel(gen);
+    }
+
+    for(int i = 0; i < myNumFields; i++)
+    {
+        mySortedIndex[i] = NULL;
+        myField[i]->unpin();
     }
+}
 
-    if(Dataset::useDoublePrecision()) filterKernel<double>(ti->getTimestamp());
-    else filterKernel<float>(ti->getTimestamp());
+///////////////////////////////////////////////////////////////////////////////
+void Filter::loadDone(Field* f)
+{
+    // Failed or cancelled loads are not retried until the filter changes.
+    if(!f->loaded) return;
+    myUpdater.clearQueue();
+    myUpdater.queue(this);
 }
 
 ///////////////////////////////////////////////////////////////////////////////
@@ -139,14 +738,30 @@ GpuBuffer* Filter::getIndexBuffer(const DrawContext& dc)
         myGpuBuffer(dc)->setType(GpuBuffer::IndexData);
     }
 
-    // Do we need to update the gpu buffer with new data?
-    if(myGpuBuffer.stamp(dc) < myIndexStamp)
+    // Do we need to update the gpu buffer with new data? Index lists are
+    // generated from the result bitmap for the upload only.
+    double stamp = getIndexStamp();
+    if(myGpuBuffer.stamp(dc) < stamp)
     {
-        myLock.lock();
-        myGpuBuffer.stamp(dc) = myIndexStamp;
-        myGpuBuffer(dc)->setData(myIndexLen * sizeof(uint), myIndices);
-        myLock.unlock();
+        myGpuBuffer.stamp(dc) = stamp;
+        Ref<Bitmap> r = getResult();
+        if(r != NULL)
+        {
+            // Index buffers hold 32 bit indices: a draw call addresses less
+            // than 2^32 elements.
+            uint n = (uint)r->getCardinality(0, MAX_INDEXED_LENGTH);
+            Vector<uint> indices(n + 1);
+            r->toIndices(0, MAX_INDEXED_LENGTH, &indices[0]);
+            myGpuBuffer(dc)->setData(n * sizeof(uint), &indices[0]);
+            myIndexLength[dc.gpuContext->getId()] = n;
+        }
     }
     return myGpuBuffer(dc);
 
 }
+
+///////////////////////////////////////////////////////////////////////////////
+uint Filter::getIndexLength(const DrawContext& dc)
+{
+    return myIndexLength[dc.gpuContext->getId()];
+}
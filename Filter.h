@@ -2,45 +2,164 @@
 #define __FILTER_H__
 
 #include <omega.h>
+#include "Dataset.h"
+#include "SortedIndex.h"
+#include "Bitmap.h"
+#include "FilterScan.h"
 
 using namespace omega;
 
-class Dataset;
-class Field;
-
-///////////////////////////////////////////////////////////////////////////////
-class Filter : public WorkerTask
+//! Selects data elements. A filter either tests field values against ranges,
+//! or combines the results of other filters with a set operation. Results
+//! are stored as compressed bitmaps; index lists are only generated for
+//! index buffer uploads.
+//! Range changes bump an atomic generation counter, which running filter
+//! passes check between chunks to abandon stale work. Results are handed to
+//! readers through two slots: readers never take the filter lock, so drawing
+//! never waits for a filter pass or set operation.
+//! Filters with fields that are not loaded request their load, and run again
+//! when it completes.
+class Filter : public WorkerTask, public LoadListener
 {
 public:
     static const int MaxFields = 4;
 
+    enum Operation
+    {
+        Range,
+        And,
+        Or,
+        Not
+    };
+
     Filter();
     ~Filter();
     void setField(uint index, Field* f);
     void setRange(uint index, float fmin, float fmax);
     void setNormalizedRange(uint index, float fmin, float fmax);
+
+    //! Makes this filter select the elements selected by both a and b.
+    void setAnd(Filter* a, Filter* b);
+    //! Makes this filter select the elements selected by a or b.
+    void setOr(Filter* a, Filter* b);
+    //! Makes this filter select the elements not selected by a.
+    void setNot(Filter* a);
+
     void execute(WorkerTask::TaskInfo* ti);
+    void loadDone(Field* f);
     void update();
     GpuBuffer* getIndexBuffer(const DrawContext& dc);
-    uint getFilteredLength() { return myIndexLen; }
+    //! Returns the number of indices in the index buffer of a draw context.
+    uint getIndexLength(const DrawContext& dc);
+    //! Returns false if the filter selects everything (i.e. no filter fields
+    //! set).
+    bool hasSelection() { return getResult() != NULL; }
+    //! Returns the number of selected elements. Filters selecting everything
+    //! return the length of their domain (0 for set operations).
+    uint64_t getFilteredLength();
+
+    int getNumFields() { return myNumFields; }
+    Field* getField(uint index) { return myField[index]; }
+    //! Returns the range of field index.
+    Vector2f getRange(uint index) { return Vector2f(myMin[index], myMax[index]); }
 
-    double getIndexStamp() { return myIndexStamp; }
+    //! Returns the filter result, or NULL if the filter selects everything.
+    Ref<Bitmap> getResult();
+    double getIndexStamp();
+
+    //! Sets the time between partial results published during full scans,
+    //! in seconds. Partial results hold the elements of the chunks scanned so
+    //! far. 0 only publishes complete results.
+    void setProgressInterval(float seconds) { myProgressInterval = seconds; }
+    float getProgressInterval() { return myProgressInterval; }
 
 private:
-    template<typename T> void filterKernel(double timestamp);
+    friend class ScanChunkTask;
 
+    void filterKernel(int generation);
+    //! Filters elements [start, end) and writes the indices of passing
+    //! elements, relative to start, to out. Returns false if the filter 
+    //! range changed while filtering.
+    bool filterRange(uint64_t start, uint64_t end, uint* out, uint* count, int generation);
+    //! Updates the previous filter result for the new ranges: previously
+    //! passing elements are tested again, and elements admitted by widened
+    //! ranges are found through the field sorted indices. Returns false if
+    //! the change is too large and a full filter pass is needed.
+    template<typename T> bool refine(int generation);
+    //! Answers the filter with the field sorted indices: the elements in
+    //! range of the most selective field are tested against the other 
+    //! ranges. Returns false if a field has no sorted index, or the query
+    //! is not selective enough.
+    template<typename T> bool query(int generation);
+    template<typename T> bool passes(uint i);
+    //! Gets the sorted index of field j, building it if needed.
+    SortedIndex* getSortedIndex(int j);
+    //! Called by the scan when a chunk is done. Publishes a partial result
+    //! if the progress interval elapsed.
+    void chunkScanned(FilterScan::Request* r, size_t chunk);
+    //! Replaces the filter result. Partial results are not used to refine
+    //! later results.
+    void publish(Bitmap* result, bool complete = true);
+    void setOperation(Operation op, Filter* a, Filter* b);
+    //! Computes the set operation result if an operand changed, and
+    //! publishes it. Runs on the updater.
+    void updateSetOperation();
+    //! Returns the latest index stamp of the set operation operands.
+    double getOperandStamp();
+    //! Returns true if the ranges changed since generation was read.
+    bool isStale(int generation);
+    void rangeChanged();
+    //! Reads the current result without locking.
+    Ref<Bitmap> readResult();
+    //! Replaces the current result. Called with myLock held.
+    void writeResult(Bitmap* result);
 
 private:
     WorkerPool myUpdater;
     GpuRef<GpuBuffer> myGpuBuffer;
+    // Serializes result writers (filter passes, set operation evaluation).
     Lock myLock;
-    uint* myIndices;
-    uint myIndexLen;
+    // Result slots. Readers use the current slot, writers fill the other one
+    // and then make it current. Each slot counts the readers copying it.
+    Ref<Bitmap> myResultSlot[2];
+    volatile int myCurrentSlot;
+    volatile int mySlotReaders[2];
+
+    // Set operation state. The result of set operations is computed by the
+    // updater when requested, if an operand changed since myOperandStamp.
+    Operation myOperation;
+    Ref<Filter> myOperand[2];
+    double myOperandStamp;
     Field* myField[MaxFields];
+    const void* myColumns[MaxFields];
+    // Scan chunks done, and partial result state.
+    Vector<int> myChunkDone;
+    float myProgressInterval;
+    double myProgressStamp;
+    volatile int myPartialPublishers;
+    // Number of indices uploaded to the index buffer of each context.
+    uint myIndexLength[GpuContext::MaxContexts];
     float myMin[MaxFields];
     float myMax[MaxFields];
     int myNumFields;
-    double myRangeStamp;
+
+    // Ranges used by the running filter pass.
+    float myRunMin[MaxFields];
+    float myRunMax[MaxFields];
+
+    // Fields, field versions and ranges the current result was computed for.
+    int myResultNumFields;
+    Field* myResultField[MaxFields];
+    uint myResultVersion[MaxFields];
+    float myResultMin[MaxFields];
+    float myResultMax[MaxFields];
+
+    // Sorted indices of the fields used by the running filter pass.
+    Ref<SortedIndex> mySortedIndex[MaxFields];
+    // Datasets with loads this filter waits for.
+    Vector< Ref<Dataset> > myLoadSources;
+    // Incremented on every range change.
+    volatile int myGeneration;
     double myIndexStamp;
 };
 
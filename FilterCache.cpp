@@ -0,0 +1,116 @@
+#include "FilterCache.h"
+
+// Default memory budget of cached filter results (bytes)
+#define DEFAULT_BUDGET (64 * 1024 * 1024)
+
+FilterCache* FilterCache::mysInstance = NULL;
+
+///////////////////////////////////////////////////////////////////////////////
+bool FilterCache::Key::operator==(const Key& rhs) const
+{
+    if(numFields != rhs.numFields) return false;
+    for(int j = 0; j < numFields; j++)
+    {
+        if(fields[j] != rhs.fields[j] ||
+            versions[j] != rhs.versions[j] ||
+            min[j] != rhs.min[j] ||
+            max[j] != rhs.max[j]) return false;
+    }
+    return true;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+FilterCache* FilterCache::instance()
+{
+    if(mysInstance == NULL) mysInstance = new FilterCache();
+    return mysInstance;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+FilterCache::FilterCache():
+    myBudget(DEFAULT_BUDGET),
+    myUsedBytes(0)
+{
+}
+
+///////////////////////////////////////////////////////////////////////////////
+void FilterCache::setBudget(size_t bytes)
+{
+    AutoLock al(myLock);
+    myBudget = bytes;
+    evict();
+}
+
+///////////////////////////////////////////////////////////////////////////////
+bool FilterCache::isStale(const Entry& e)
+{
+    for(int j = 0; j < e.key.numFields; j++)
+    {
+        if(e.fields[j]->version != e.key.versions[j]) return true;
+    }
+    return false;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+Ref<Bitmap> FilterCache::find(const Key& k)
+{
+    AutoLock al(myLock);
+    List<Entry>::iterator it = myEntries.begin();
+    while(it != myEntries.end())
+    {
+        if(isStale(*it))
+        {
+            myUsedBytes -= it->bytes;
+            it = myEntries.erase(it);
+        }
+        else if(it->key == k)
+        {
+            // Move the entry to the front of the LRU list.
+            myEntries.splice(myEntries.begin(), myEntries, it);
+            return myEntries.front().result;
+        }
+        else
+        {
+            ++it;
+        }
+    }
+    return NULL;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+void FilterCache::add(const Key& k, Bitmap* result)
+{
+    AutoLock al(myLock);
+    if(myBudget == 0 || result == NULL) return;
+
+    // Results found in the cache get published again.
+    for(List<Entry>::iterator it = myEntries.begin(); it != myEntries.end(); ++it)
+    {
+        if(it->key == k)
+        {
+            myEntries.splice(myEntries.begin(), myEntries, it);
+            return;
+        }
+    }
+
+    Entry e;
+    e.key = k;
+    for(int j = 0; j < k.numFields; j++) e.fields[j] = k.fields[j];
+    e.result = result;
+    e.bytes = result->getMemorySize();
+    if(e.bytes > myBudget) return;
+
+    myEntries.push_front(e);
+    myUsedBytes += e.bytes;
+    evict();
+}
+
+///////////////////////////////////////////////////////////////////////////////
+void FilterCache::evict()
+{
+    while(myUsedBytes > myBudget && !myEntries.empty())
+    {
+        myUsedBytes -= myEntries.back().bytes;
+        myEntries.pop_back();
+    }
+}
@@ -0,0 +1,70 @@
+#ifndef __FILTER_CACHE__
+#define __FILTER_CACHE__
+
+#include <omega.h>
+#include "Dataset.h"
+#include "Filter.h"
+
+using namespace omega;
+
+///////////////////////////////////////////////////////////////////////////////
+//! Keeps recent filter results, so filters going back to ranges used before
+//! (i.e. brushes flipping between a few selections) get their result without
+//! filtering again. Results are keyed by fields, field versions and ranges.
+//! Entries of fields whose data changed since are dropped on lookup. When 
+//! the memory budget is exceeded, the least recently used results are freed.
+//! Results are immutable, so filters share them.
+class FilterCache
+{
+public:
+    struct Key
+    {
+        int numFields;
+        Field* fields[Filter::MaxFields];
+        uint versions[Filter::MaxFields];
+        float min[Filter::MaxFields];
+        float max[Filter::MaxFields];
+
+        bool operator==(const Key& rhs) const;
+    };
+
+public:
+    static FilterCache* instance();
+
+    //! Sets the memory budget in bytes. 0 disables the cache.
+    void setBudget(size_t bytes);
+    size_t getBudget() { return myBudget; }
+    size_t getUsedBytes() { return myUsedBytes; }
+
+    //! Returns the result cached for a key, or NULL.
+    Ref<Bitmap> find(const Key& k);
+    //! Adds a result. Evicts other results if the budget is exceeded.
+    void add(const Key& k, Bitmap* result);
+
+private:
+    struct Entry
+    {
+        Key key;
+        // Keeps the fields alive, so their addresses are not reused by other
+        // fields while the entry exists.
+        Ref<Field> fields[Filter::MaxFields];
+        Ref<Bitmap> result;
+        size_t bytes;
+    };
+
+    FilterCache();
+    //! Returns true if the data of an entry field changed.
+    static bool isStale(const Entry& e);
+    void evict();
+
+private:
+    static FilterCache* mysInstance;
+
+    Lock myLock;
+    // Most recently used entries first.
+    List<Entry> myEntries;
+    size_t myBudget;
+    size_t myUsedBytes;
+};
+
+#endif
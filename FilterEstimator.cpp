@@ -0,0 +1,191 @@
+#include "FilterEstimator.h"
+
+// Normal quantile of the confidence intervals (95%)
+#define CONFIDENCE_Z 1.96
+
+///////////////////////////////////////////////////////////////////////////////
+// Counts the sample elements passing the filter ranges, and the passing
+// elements in each histogram bin. NaN values pass, as in Filter.
+template<typename T>
+static uint countPassing(const void** columns, int numColumns, const float* vmin, 
+    const float* vmax, size_t n, int histColumn, double hmin, double hmax, 
+    Vector<uint>& bins)
+{
+    int numBins = (int)bins.size();
+    double scale = hmax > hmin ? numBins / (hmax - hmin) : 0;
+    uint k = 0;
+    for(size_t i = 0; i < n; i++)
+    {
+        bool pass = true;
+        for(int j = 0; j < numColumns; j++)
+        {
+            T v = ((const T*)columns[j])[i];
+            pass &= !(v < vmin[j]) & !(v > vmax[j]);
+        }
+        if(!pass) continue;
+        k++;
+
+        if(numBins == 0) continue;
+        T v = ((const T*)columns[histColumn])[i];
+        if(v != v) continue;
+        double b = (v - hmin) * scale;
+        if(b < 0) b = 0;
+        if(b > numBins - 1) b = numBins - 1;
+        bins[(int)b]++;
+    }
+    return k;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+FilterEstimator::FilterEstimator():
+    myHistogramField(0),
+    myNumBins(0),
+    mySampleSize(0),
+    myPopulation(0)
+{
+    myCount.value = 0;
+    myCount.low = 0;
+    myCount.high = 0;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+void FilterEstimator::setSample(uint index, Field* f)
+{
+    if(index >= Filter::MaxFields) return;
+    if(!matchesFilter(index, f))
+    {
+        ofwarn("[FilterEstimator::setSample] sample %1% is not of the dimension of filter field %2%",
+            %f->getName() %index);
+        return;
+    }
+    mySample[index] = f;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+bool FilterEstimator::matchesFilter(uint index, Field* f)
+{
+    if(f == NULL || myFilter == NULL || (int)index >= myFilter->getNumFields()) return true;
+    return f->getDimension() == myFilter->getField(index)->getDimension();
+}
+
+///////////////////////////////////////////////////////////////////////////////
+void FilterEstimator::setHistogram(uint index, int bins)
+{
+    if(index >= Filter::MaxFields) return;
+    myHistogramField = index;
+    myNumBins = max(bins, 0);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+bool FilterEstimator::update()
+{
+    if(myFilter == NULL) return false;
+    int nf = myFilter->getNumFields();
+    if(nf == 0) return false;
+    for(int j = 0; j < nf; j++)
+    {
+        // The filter fields may have changed since the sample was set.
+        if(mySample[j] == NULL || !matchesFilter(j, mySample[j])) return false;
+    }
+    if(myNumBins > 0 && myHistogramField >= nf) return false;
+
+    // Pin the sample so the field cache does not evict it while we read it.
+    bool loaded = true;
+    for(int j = 0; j < nf; j++)
+    {
+        Field* f = mySample[j];
+        f->pin();
+        if(!f->loaded)
+        {
+            f->getDimension()->dataset->load(f);
+            loaded = false;
+        }
+    }
+
+    if(loaded)
+    {
+        const void* columns[Filter::MaxFields];
+        float vmin[Filter::MaxFields];
+        float vmax[Filter::MaxFields];
+        size_t n = mySample[0]->numElements();
+        for(int j = 0; j < nf; j++)
+        {
+            columns[j] = mySample[j]->data;
+            n = min(n, mySample[j]->numElements());
+            Vector2f r = myFilter->getRange(j);
+            vmin[j] = r[0];
+            vmax[j] = r[1];
+        }
+
+        Vector<uint> bins;
+        bins.assign(myNumBins, 0);
+        Dimension* hd = mySample[myHistogramField]->getDimension();
+        double hmin = hd->floatRangeMin;
+        double hmax = hd->floatRangeMax;
+        uint k;
+        if(Dataset::useDoublePrecision()) k = countPassing<double>(columns, nf, vmin, vmax, n, myHistogramField, hmin, hmax, bins);
+        else k = countPassing<float>(columns, nf, vmin, vmax, n, myHistogramField, hmin, hmax, bins);
+
+        mySampleSize = n;
+        myPopulation = myFilter->getField(0)->numElements();
+        myCount = estimate(k);
+        myBins.resize(myNumBins);
+        for(int b = 0; b < myNumBins; b++) myBins[b] = estimate(bins[b]);
+    }
+
+    for(int j = 0; j < nf; j++) mySample[j]->unpin();
+    return loaded;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+FilterEstimator::Estimate FilterEstimator::estimate(uint k)
+{
+    Estimate e;
+    double N = (double)myPopulation;
+    double n = (double)mySampleSize;
+    if(n == 0)
+    {
+        e.value = 0;
+        e.low = 0;
+        e.high = (float)N;
+        return e;
+    }
+
+    // Wilson score interval of the passing fraction, which stays meaningful
+    // for fractions close to 0 or 1. The finite population correction 
+    // narrows it as the sample covers more of the domain. Stratified samples
+    // (binary loader) vary less than simple random ones, so the interval is
+    // conservative for them. Fixed stride samples carry no such guarantee.
+    double z = CONFIDENCE_Z;
+    double p = k / n;
+    double fpc = N > n ? sqrt((N - n) / (N - 1)) : 0;
+    double d = 1 + z * z / n;
+    double center = (p + z * z / (2 * n)) / d;
+    double half = z * sqrt(p * (1 - p) / n + z * z / (4 * n * n)) / d * fpc;
+
+    e.value = (float)(p * N);
+    e.low = (float)(min(p, max(0.0, center - half)) * N);
+    e.high = (float)(max(p, min(1.0, center + half)) * N);
+    return e;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+float FilterEstimator::getBinCount(int bin)
+{
+    if(bin < 0 || bin >= (int)myBins.size()) return 0;
+    return myBins[bin].value;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+float FilterEstimator::getBinLow(int bin)
+{
+    if(bin < 0 || bin >= (int)myBins.size()) return 0;
+    return myBins[bin].low;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+float FilterEstimator::getBinHigh(int bin)
+{
+    if(bin < 0 || bin >= (int)myBins.size()) return 0;
+    return myBins[bin].high;
+}
@@ -0,0 +1,79 @@
+#ifndef __FILTER_ESTIMATOR__
+#define __FILTER_ESTIMATOR__
+
+#include <omega.h>
+#include "Dataset.h"
+#include "Filter.h"
+
+using namespace omega;
+
+///////////////////////////////////////////////////////////////////////////////
+//! Estimates the selection of a filter from a small resident sample of its
+//! fields: fields of the same dimensions over a coarse decimation of the
+//! filter domain. With the binary loader, decimated loads pick one random
+//! record in each stratum of decimation records, so the sample is stratified
+//! over the domain. Other loaders (i.e. HDF5) decimate with a fixed stride:
+//! the sample is systematic, and can be biased by periodic data.
+//! Estimates are computed in the calling thread when update is called, and
+//! come with 95% confidence intervals. Use them as immediate feedback while
+//! the exact filter result is computed.
+class FilterEstimator : public ReferenceType
+{
+public:
+    FilterEstimator();
+
+    //! Sets the filter whose ranges are estimated.
+    void setFilter(Filter* f) { myFilter = f; }
+    //! Sets the sample of the filter field at index. All sample fields must
+    //! have the same domain. Samples of a different dimension than the 
+    //! filter field are rejected.
+    void setSample(uint index, Field* f);
+    //! Estimates a histogram of the selected values of the filter field at
+    //! index, with bins bins over its dimension range. 0 bins disables it.
+    void setHistogram(uint index, int bins);
+
+    //! Evaluates the filter ranges on the sample. Returns false if the 
+    //! sample is not loaded yet. Its load is then requested.
+    bool update();
+
+    //! Returns the number of sample elements used by the last update.
+    int getSampleSize() { return (int)mySampleSize; }
+    //! Returns the estimated number of elements selected by the filter, and
+    //! the bounds of its confidence interval.
+    float getCount() { return myCount.value; }
+    float getCountLow() { return myCount.low; }
+    float getCountHigh() { return myCount.high; }
+
+    int getNumBins() { return (int)myBins.size(); }
+    //! Returns the estimated number of selected elements in a histogram bin,
+    //! and the bounds of its confidence interval.
+    float getBinCount(int bin);
+    float getBinLow(int bin);
+    float getBinHigh(int bin);
+
+private:
+    struct Estimate
+    {
+        float value;
+        float low;
+        float high;
+    };
+
+    //! Estimates a population count from k passing sample elements.
+    Estimate estimate(uint k);
+    //! Returns false if f is not of the dimension of filter field index.
+    bool matchesFilter(uint index, Field* f);
+
+private:
+    Ref<Filter> myFilter;
+    Ref<Field> mySample[Filter::MaxFields];
+    int myHistogramField;
+    int myNumBins;
+
+    size_t mySampleSize;
+    size_t myPopulation;
+    Estimate myCount;
+    Vector<Estimate> myBins;
+};
+
+#endif
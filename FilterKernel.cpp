@@ -0,0 +1,303 @@
+#include "FilterKernel.h"
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define FILTER_KERNEL_X86
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+#endif
+
+// Number of elements tested for each mask.
+#define BLOCK_SIZE 64
+
+#if defined(__GNUC__)
+#define TARGET_AVX2 __attribute__((target("avx2")))
+#define TARGET_AVX512 __attribute__((target("avx512f")))
+#else
+#define TARGET_AVX2
+#define TARGET_AVX512
+#endif
+
+typedef uint (*KernelFunc)(const void* const* columns,
+    const float* vmin, const float* vmax, uint start, uint end, uint* out);
+
+///////////////////////////////////////////////////////////////////////////////
+// Scalar kernel, also used for the tail of vector kernels. Branchless: the
+// index is always written, and the output advances only if it passes.
+template<typename T, int N>
+static uint filterScalar(const void* const* columns,
+    const float* vmin, const float* vmax, uint start, uint end, uint* out)
+{
+    const T* const* c = (const T* const*)columns;
+    uint len = 0;
+    for(uint i = start; i < end; i++)
+    {
+        bool pass = true;
+        for(int j = 0; j < N; j++)
+        {
+            T v = c[j][i];
+            pass &= !(v < vmin[j]) & !(v > vmax[j]);
+        }
+        out[len] = i;
+        len += pass;
+    }
+    return len;
+}
+
+#ifdef FILTER_KERNEL_X86
+///////////////////////////////////////////////////////////////////////////////
+// Compaction lookup table: for each byte mask, the positions of its set bits.
+struct CompressLut
+{
+    uint positions[256][8];
+    uint count[256];
+
+    CompressLut()
+    {
+        for(uint m = 0; m < 256; m++)
+        {
+            uint n = 0;
+            for(uint b = 0; b < 8; b++) if(m & (1 << b)) positions[m][n++] = b;
+            for(uint b = n; b < 8; b++) positions[m][b] = 0;
+            count[m] = n;
+        }
+    }
+};
+static CompressLut sLut;
+
+///////////////////////////////////////////////////////////////////////////////
+// AVX2 range mask of 64 floats starting at c.
+TARGET_AVX2 static inline uint64_t maskAvx2(const float* c, float fmin, float fmax)
+{
+    __m256 vmin = _mm256_set1_ps(fmin);
+    __m256 vmax = _mm256_set1_ps(fmax);
+    uint64_t m = 0;
+    for(int k = 0; k < BLOCK_SIZE / 8; k++)
+    {
+        __m256 v = _mm256_loadu_ps(c + k * 8);
+        // Not-less-than and not-greater-than are true for NaN, so NaN passes.
+        __m256 p = _mm256_and_ps(
+            _mm256_cmp_ps(v, vmin, _CMP_NLT_UQ),
+            _mm256_cmp_ps(v, vmax, _CMP_NGT_UQ));
+        m |= (uint64_t)(uint)_mm256_movemask_ps(p) << (k * 8);
+    }
+    return m;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// AVX2 range mask of 64 doubles starting at c.
+TARGET_AVX2 static inline uint64_t maskAvx2(const double* c, float fmin, float fmax)
+{
+    __m256d vmin = _mm256_set1_pd(fmin);
+    __m256d vmax = _mm256_set1_pd(fmax);
+    uint64_t m = 0;
+    for(int k = 0; k < BLOCK_SIZE / 4; k++)
+    {
+        __m256d v = _mm256_loadu_pd(c + k * 4);
+        __m256d p = _mm256_and_pd(
+            _mm256_cmp_pd(v, vmin, _CMP_NLT_UQ),
+            _mm256_cmp_pd(v, vmax, _CMP_NGT_UQ));
+        m |= (uint64_t)(uint)_mm256_movemask_pd(p) << (k * 4);
+    }
+    return m;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Writes the indices of the set bits of m (base + bit) to out, 8 at a time
+// through the lookup table. Returns the number of indices written.
+TARGET_AVX2 static inline uint compressAvx2(uint64_t m, uint base, uint* out)
+{
+    uint len = 0;
+    for(int k = 0; k < BLOCK_SIZE / 8; k++)
+    {
+        uint b = (uint)(m >> (k * 8)) & 0xff;
+        if(b == 0) continue;
+        __m256i pos = _mm256_loadu_si256((const __m256i*)sLut.positions[b]);
+        __m256i idx = _mm256_add_epi32(pos, _mm256_set1_epi32(base + k * 8));
+        _mm256_storeu_si256((__m256i*)(out + len), idx);
+        len += sLut.count[b];
+    }
+    return len;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+template<typename T, int N>
+TARGET_AVX2 static uint filterAvx2(const void* const* columns,
+    const float* vmin, const float* vmax, uint start, uint end, uint* out)
+{
+    const T* const* c = (const T* const*)columns;
+    uint len = 0;
+    uint i = start;
+    for(; i + BLOCK_SIZE <= end; i += BLOCK_SIZE)
+    {
+        uint64_t m = maskAvx2(c[0] + i, vmin[0], vmax[0]);
+        for(int j = 1; j < N && m != 0; j++) m &= maskAvx2(c[j] + i, vmin[j], vmax[j]);
+        len += compressAvx2(m, i, out + len);
+    }
+    return len + filterScalar<T, N>(columns, vmin, vmax, i, end, out + len);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// AVX-512 range mask of 64 floats starting at c.
+TARGET_AVX512 static inline uint64_t maskAvx512(const float* c, float fmin, float fmax)
+{
+    __m512 vmin = _mm512_set1_ps(fmin);
+    __m512 vmax = _mm512_set1_ps(fmax);
+    uint64_t m = 0;
+    for(int k = 0; k < BLOCK_SIZE / 16; k++)
+    {
+        __m512 v = _mm512_loadu_ps(c + k * 16);
+        __mmask16 p = _mm512_cmp_ps_mask(v, vmin, _CMP_NLT_UQ) &
+            _mm512_cmp_ps_mask(v, vmax, _CMP_NGT_UQ);
+        m |= (uint64_t)p << (k * 16);
+    }
+    return m;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// AVX-512 range mask of 64 doubles starting at c.
+TARGET_AVX512 static inline uint64_t maskAvx512(const double* c, float fmin, float fmax)
+{
+    __m512d vmin = _mm512_set1_pd(fmin);
+    __m512d vmax = _mm512_set1_pd(fmax);
+    uint64_t m = 0;
+    for(int k = 0; k < BLOCK_SIZE / 8; k++)
+    {
+        __m512d v = _mm512_loadu_pd(c + k * 8);
+        __mmask8 p = _mm512_cmp_pd_mask(v, vmin, _CMP_NLT_UQ) &
+            _mm512_cmp_pd_mask(v, vmax, _CMP_NGT_UQ);
+        m |= (uint64_t)p << (k * 8);
+    }
+    return m;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Writes the indices of the set bits of m (base + bit) to out with compress
+// stores. Returns the number of indices written.
+TARGET_AVX512 static inline uint compressAvx512(uint64_t m, uint base, uint* out)
+{
+    const __m512i iota = _mm512_set_epi32(15, 14, 13, 12, 11, 10, 9, 8, 7, 6, 5, 4, 3, 2, 1, 0);
+    uint len = 0;
+    for(int k = 0; k < BLOCK_SIZE / 16; k++)
+    {
+        __mmask16 b = (__mmask16)(m >> (k * 16));
+        if(b == 0) continue;
+        __m512i idx = _mm512_add_epi32(iota, _mm512_set1_epi32(base + k * 16));
+        _mm512_mask_compressstoreu_epi32(out + len, b, idx);
+        len += sLut.count[b & 0xff] + sLut.count[b >> 8];
+    }
+    return len;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+template<typename T, int N>
+TARGET_AVX512 static uint filterAvx512(const void* const* columns,
+    const float* vmin, const float* vmax, uint start, uint end, uint* out)
+{
+    const T* const* c = (const T* const*)columns;
+    uint len = 0;
+    uint i = start;
+    for(; i + BLOCK_SIZE <= end; i += BLOCK_SIZE)
+    {
+        uint64_t m = maskAvx512(c[0] + i, vmin[0], vmax[0]);
+        for(int j = 1; j < N && m != 0; j++) m &= maskAvx512(c[j] + i, vmin[j], vmax[j]);
+        len += compressAvx512(m, i, out + len);
+    }
+    return len + filterScalar<T, N>(columns, vmin, vmax, i, end, out + len);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+static bool cpuSupports(const char* isa)
+{
+#if defined(__GNUC__)
+    __builtin_cpu_init();
+    if(!strcmp(isa, "avx512")) return __builtin_cpu_supports("avx512f");
+    if(!strcmp(isa, "avx2")) return __builtin_cpu_supports("avx2");
+    return false;
+#elif defined(_MSC_VER)
+    int r[4];
+    __cpuid(r, 1);
+    // The OS must save the AVX (and AVX-512) register state.
+    bool osxsave = (r[2] & (1 << 27)) != 0;
+    if(!osxsave) return false;
+    unsigned long long xcr0 = _xgetbv(0);
+    __cpuidex(r, 7, 0);
+    if(!strcmp(isa, "avx512")) return (r[1] & (1 << 16)) && (xcr0 & 0xe6) == 0xe6;
+    if(!strcmp(isa, "avx2")) return (r[1] & (1 << 5)) && (xcr0 & 0x6) == 0x6;
+    return false;
+#else
+    return false;
+#endif
+}
+#endif
+
+enum InstructionSet { Scalar, Avx2, Avx512 };
+
+///////////////////////////////////////////////////////////////////////////////
+template<typename T, int N>
+static KernelFunc selectKernel(InstructionSet isa)
+{
+#ifdef FILTER_KERNEL_X86
+    if(isa == Avx512) return filterAvx512<T, N>;
+    if(isa == Avx2) return filterAvx2<T, N>;
+#endif
+    return filterScalar<T, N>;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Kernels for each precision (float, double) and number of columns, selected
+// for the cpu on first use.
+struct KernelTable
+{
+    KernelFunc kernels[2][FilterKernel::MaxColumns];
+    const char* isaName;
+
+    KernelTable()
+    {
+        InstructionSet isa = Scalar;
+        isaName = "scalar";
+#ifdef FILTER_KERNEL_X86
+        if(cpuSupports("avx512"))
+        {
+            isa = Avx512;
+            isaName = "avx512";
+        }
+        else if(cpuSupports("avx2"))
+        {
+            isa = Avx2;
+            isaName = "avx2";
+        }
+#endif
+        kernels[0][0] = selectKernel<float, 1>(isa);
+        kernels[0][1] = selectKernel<float, 2>(isa);
+        kernels[0][2] = selectKernel<float, 3>(isa);
+        kernels[0][3] = selectKernel<float, 4>(isa);
+        kernels[1][0] = selectKernel<double, 1>(isa);
+        kernels[1][1] = selectKernel<double, 2>(isa);
+        kernels[1][2] = selectKernel<double, 3>(isa);
+        kernels[1][3] = selectKernel<double, 4>(isa);
+    }
+};
+
+///////////////////////////////////////////////////////////////////////////////
+static KernelTable& getKernels()
+{
+    static KernelTable sKernels;
+    return sKernels;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+uint FilterKernel::run(const void* const* columns, int numColumns, bool doublePrecision,
+    const float* vmin, const float* vmax, uint start, uint end, uint* out)
+{
+    oassert(numColumns > 0 && numColumns <= MaxColumns);
+    KernelFunc k = getKernels().kernels[doublePrecision ? 1 : 0][numColumns - 1];
+    return k(columns, vmin, vmax, start, end, out);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+const char* FilterKernel::getInstructionSet()
+{
+    return getKernels().isaName;
+}
@@ -0,0 +1,32 @@
+#ifndef __FILTER_KERNEL__
+#define __FILTER_KERNEL__
+
+#include <omega.h>
+
+using namespace omega;
+
+///////////////////////////////////////////////////////////////////////////////
+//! Column-at-a-time range filter. For each block of 64 elements, the range
+//! test of each column (vmin <= v <= vmax, NaN values pass) is evaluated into
+//! a bitmask. Column masks are ANDed, and the indices of the passing elements
+//! are compacted into the output.
+//! Uses AVX-512 or AVX2 when the cpu supports them, scalar code otherwise.
+//! Kernels are specialized for float and double data and for 1 to 4 columns.
+class FilterKernel
+{
+public:
+    static const int MaxColumns = 4;
+    //! Number of elements the output array needs past the filtered length:
+    //! vector compaction stores whole registers.
+    static const uint OutputPadding = 16;
+
+    //! Filters elements [start, end) of the columns (float or double arrays).
+    //! Writes the indices of passing elements to out and returns their count.
+    static uint run(const void* const* columns, int numColumns, bool doublePrecision,
+        const float* vmin, const float* vmax, uint start, uint end, uint* out);
+
+    //! Returns the instruction set used by the kernels: avx512, avx2 or scalar.
+    static const char* getInstructionSet();
+};
+
+#endif
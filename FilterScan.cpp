@@ -0,0 +1,140 @@
+#include "FilterScan.h"
+#include "Filter.h"
+#include "FilterKernel.h"
+#include "ComputePool.h"
+
+
+// Number of passes over different fields that can run at the same time.
+#define PASS_THREADS 4
+
+FilterScan* FilterScan::mysInstance = NULL;
+
+///////////////////////////////////////////////////////////////////////////////
+// Runs the passes of a key.
+class PassTask : public WorkerTask
+{
+public:
+    const void* key;
+
+    void execute(WorkerTask::TaskInfo* ti)
+    {
+        FilterScan::instance()->runPasses(key);
+    }
+};
+
+///////////////////////////////////////////////////////////////////////////////
+// Runs all requests of a pass on one chunk. Completed requests are removed 
+// from the batch (set to NULL): their memory belongs to the scanning thread.
+class ScanChunkTask : public ParallelTask
+{
+public:
+    FilterScan* scan;
+    Vector<FilterScan::Request*>* batch;
+
+    void run(size_t chunk)
+    {
+        uint64_t start = (uint64_t)chunk * FilterScan::ChunkSize;
+        Monitor& m = scan->myMonitor;
+        for(size_t i = 0; i < batch->size(); i++)
+        {
+            m.lock();
+            FilterScan::Request* r = (*batch)[i];
+            if(r == NULL || r->stale || start >= r->size)
+            {
+                m.unlock();
+                continue;
+            }
+            r->active++;
+            m.unlock();
+
+            uint64_t end = min(start + FilterScan::ChunkSize, r->size);
+            uint* out = r->scratch + chunk * (FilterScan::ChunkSize + FilterKernel::OutputPadding);
+            bool scanned = r->filter->filterRange(start, end, out, &r->counts[chunk], r->generation);
+            if(scanned) r->filter->chunkScanned(r, chunk);
+
+            m.lock();
+            r->active--;
+            if(scanned) r->remaining--;
+            else r->stale = true;
+            scan->chunkEnded(*batch, i);
+            m.unlock();
+        }
+    }
+};
+
+///////////////////////////////////////////////////////////////////////////////
+FilterScan* FilterScan::instance()
+{
+    if(mysInstance == NULL) mysInstance = new FilterScan();
+    return mysInstance;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+FilterScan::FilterScan()
+{
+    myPasses.start(PASS_THREADS);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+void FilterScan::scan(Request* r)
+{
+    r->stale = false;
+    r->active = 0;
+    r->remaining = (size_t)((r->size + ChunkSize - 1) / ChunkSize);
+    r->done = (r->remaining == 0);
+    if(r->done) return;
+
+    // Join the next pass over the key. If no pass task runs for the key,
+    // start one.
+    myMonitor.lock();
+    bool running = myPending.find(r->key) != myPending.end();
+    myPending[r->key].push_back(r);
+    myMonitor.unlock();
+
+    if(!running)
+    {
+        Ref<PassTask> task = new PassTask();
+        task->key = r->key;
+        myPasses.queue(task);
+    }
+
+    myMonitor.lock();
+    while(!r->done) myMonitor.wait();
+    myMonitor.unlock();
+}
+
+///////////////////////////////////////////////////////////////////////////////
+void FilterScan::runPasses(const void* key)
+{
+    while(true)
+    {
+        // Take the requests batched since the last pass. The key leaves the 
+        // map once no request is left, so the next scan starts a new task.
+        Vector<Request*> batch;
+        myMonitor.lock();
+        std::map< const void*, Vector<Request*> >::iterator it = myPending.find(key);
+        batch.swap(it->second);
+        if(batch.empty()) myPending.erase(it);
+        myMonitor.unlock();
+        if(batch.empty()) return;
+
+        uint64_t size = 0;
+        foreach(Request* r, batch) size = max(size, r->size);
+
+        ScanChunkTask task;
+        task.scan = this;
+        task.batch = &batch;
+        ComputePool::instance()->parallelFor(&task, (size_t)((size + ChunkSize - 1) / ChunkSize));
+    }
+}
+
+///////////////////////////////////////////////////////////////////////////////
+void FilterScan::chunkEnded(Vector<Request*>& batch, size_t index)
+{
+    Request* r = batch[index];
+    if(r->active > 0 || (!r->stale && r->remaining > 0)) return;
+
+    batch[index] = NULL;
+    r->done = true;
+    myMonitor.notifyAll();
+}
@@ -0,0 +1,80 @@
+#ifndef __FILTER_SCAN__
+#define __FILTER_SCAN__
+
+#include <omega.h>
+#include "Monitor.h"
+
+#include <map>
+
+using namespace omega;
+
+class Filter;
+class PassTask;
+
+///////////////////////////////////////////////////////////////////////////////
+//! Runs the full data scans of filters. Filters are grouped into passes by
+//! their first field: filters that need a scan of fields that are being
+//! scanned are batched into the next pass over those fields. A pass walks the
+//! data in chunks small enough to stay in cache, and evaluates every batched
+//! filter on a chunk before moving to the next one: filters over the same
+//! fields (i.e. the selection filters of different clients) share the memory 
+//! traffic of a single scan. Each filter still gets its own result.
+//! Passes over different fields run at the same time on their own threads.
+//! A scan returns as soon as its own chunks are done or its filter ranges 
+//! change, without waiting for the rest of its pass.
+class FilterScan
+{
+public:
+    //! Number of elements per scan chunk.
+    static const uint ChunkSize = 16384;
+
+    //! A filter scan. Each chunk c writes its passing indices, relative to
+    //! the chunk start, to scratch + c * (ChunkSize + 
+    //! FilterKernel::OutputPadding), and their number to counts[c].
+    struct Request
+    {
+        Filter* filter;
+        int generation;
+        //! Data of the first filter field. Requests with the same key are run
+        //! back to back on each chunk.
+        const void* key;
+        uint64_t size;
+        uint* scratch;
+        uint* counts;
+        //! Set if the filter ranges changed during the scan.
+        bool stale;
+        bool done;
+        //! Chunks being scanned, and chunks left to scan.
+        size_t active;
+        size_t remaining;
+    };
+
+    static FilterScan* instance();
+
+    //! Scans the elements of a filter. Returns when the scan is done.
+    void scan(Request* r);
+
+private:
+    friend class PassTask;
+    friend class ScanChunkTask;
+
+    FilterScan();
+    //! Runs passes for the requests pending on key, until none is left.
+    void runPasses(const void* key);
+    //! Called with the monitor locked when a request stops scanning a chunk.
+    //! Completes the request if it is stale or has no chunks left.
+    void chunkEnded(Vector<Request*>& batch, size_t index);
+
+private:
+    static FilterScan* mysInstance;
+
+    // Protects the request states and the pending lists. Scanning threads 
+    // wait on it for their request to complete.
+    Monitor myMonitor;
+    // Requests waiting for the next pass, by key. Keys in the map have a 
+    // pass task running or queued.
+    std::map< const void*, Vector<Request*> > myPending;
+    WorkerPool myPasses;
+};
+
+#endif
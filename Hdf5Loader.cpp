@@ -2,6 +2,7 @@
 
 #include "signac.h"
 #include "Hdf5Loader.h"
+#include "FieldAllocator.h"
 
 // Maximum number of rows that can be read for each loaded block.
 #define MAX_ROWS_PER_BLOCK 65535
@@ -30,6 +31,13 @@ public:
 
     void execute(WorkerTask::TaskInfo* ti)
     {
+        Dataset* ds = field->getDimension()->dataset;
+        if(field->cancelled)
+        {
+            ds->loadCancelled(field);
+            return;
+        }
+
         hid_t file_id;
         herr_t status;
         String fullpath;
@@ -37,6 +45,13 @@ public:
         {
             hdf5APIlock.lock();
             file_id = H5Fopen(fullpath.c_str(), H5F_ACC_RDONLY, H5P_DEFAULT);
+            if(file_id < 0)
+            {
+                hdf5APIlock.unlock();
+                ofwarn("[Hdf5LoadTask::execute] failed opening %1%", %fullpath);
+                ds->loadFailed(field);
+                return;
+            }
 
             // Find the dimension and datset name
             String dimname = field->getDimension()->id;
@@ -55,9 +70,12 @@ public:
 
 
             hid_t dataset_id = H5Dopen2(file_id, dsetname.c_str(), H5P_DEFAULT);
-            if(dataset_id == -1)
+            if(dataset_id < 0)
             {
-                ofwarn("Failed opening dataset %1%", %dsetname);
+                H5Fclose(file_id);
+                hdf5APIlock.unlock();
+                ofwarn("[Hdf5LoadTask::execute] failed opening dataset %1%", %dsetname);
+                ds->loadFailed(field);
                 return;
             }
             hid_t dspace_id = H5Dget_space(dataset_id);
@@ -88,9 +106,20 @@ public:
             oassert(p1 == p2);
 
             oflog(Debug, "reading %1% - offs %2%", %dsetname %sstart);
-            float* fielddata = (float*)malloc(p1 * sizeof(float));
+            float* fielddata = (float*)FieldAllocator::allocate(p1 * sizeof(float));
             status = H5Dread(dataset_id, H5T_IEEE_F32LE, mspace_id, dspace_id, H5P_DEFAULT, fielddata);
-            oassert(status != -1);
+            if(status < 0)
+            {
+                FieldAllocator::free((char*)fielddata);
+                H5Sclose(mspace_id);
+                H5Sclose(dspace_id);
+                H5Dclose(dataset_id);
+                H5Fclose(file_id);
+                hdf5APIlock.unlock();
+                ofwarn("[Hdf5LoadTask::execute] failed reading dataset %1%", %dsetname);
+                ds->loadFailed(field);
+                return;
+            }
             hdf5APIlock.unlock();
 
             field->lock.lock();
@@ -109,9 +138,10 @@ public:
             // Update field length
             field->data = (char*)fielddata;
             field->loaded = true;
-            field->stamp = otimestamp();
+            field->dataChanged();
             field->lock.unlock();
 
+            ds->loadCompleted(field);
             Signac::instance->signalFieldLoaded(field);
 
             hdf5APIlock.lock();
@@ -121,6 +151,11 @@ public:
             H5Fclose(file_id);
             hdf5APIlock.unlock();
         }
+        else
+        {
+            ofwarn("[Hdf5LoadTask::execute] could not find %1%", %path);
+            ds->loadFailed(field);
+        }
     }
 
 };
@@ -159,5 +194,5 @@ void Hdf5Loader::load(Field* f)
     task->blockLength = BLOCK_SIZE;
     task->path = myFilename;
 
-    Signac::instance->addTask(task);
+    Signac::instance->addTask(task, f);
 }
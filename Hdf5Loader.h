@@ -14,6 +14,7 @@ public:
     void open(const String& source);
     void load(Field* f);
     size_t getNumRecords(Dataset* d);
+    String getSource() { return myFilename; }
 
 protected:
     String myFilename;
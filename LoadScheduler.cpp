@@ -0,0 +1,121 @@
+#include "LoadScheduler.h"
+
+// Time between refreshes of all pending request priorities (seconds).
+#define REFRESH_INTERVAL 0.1
+
+///////////////////////////////////////////////////////////////////////////////
+void LoadScheduler::Dispatcher::execute(WorkerTask::TaskInfo* ti)
+{
+    Request r;
+    if(myOwner->pop(&r)) r.task->execute(ti);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+LoadScheduler::LoadScheduler():
+    myRefreshStamp(0)
+{
+    myDispatcher = new Dispatcher(this);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+LoadScheduler::~LoadScheduler()
+{
+    stop();
+}
+
+///////////////////////////////////////////////////////////////////////////////
+void LoadScheduler::start(int threads)
+{
+    myPool.start(threads);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+void LoadScheduler::stop()
+{
+    clearQueue();
+    myPool.stop();
+}
+
+///////////////////////////////////////////////////////////////////////////////
+void LoadScheduler::clearQueue()
+{
+    AutoLock al(myLock);
+    myPool.clearQueue();
+    myPending.clear();
+}
+
+///////////////////////////////////////////////////////////////////////////////
+void LoadScheduler::queue(WorkerTask* task, Field* f)
+{
+    Request r;
+    r.task = task;
+    r.field = f;
+
+    myLock.lock();
+    myPending.insert(RequestMap::value_type(getPriority(r, otimestamp()), r));
+    myLock.unlock();
+
+    // Every request gets a dispatch slot in the pool. The slot does not run
+    // this request, but whatever is most important when a worker picks it up.
+    myPool.queue(myDispatcher);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+size_t LoadScheduler::getNumPending()
+{
+    AutoLock al(myLock);
+    return myPending.size();
+}
+
+///////////////////////////////////////////////////////////////////////////////
+float LoadScheduler::getPriority(const Request& r, double now)
+{
+    if(r.field.isNull()) return Field::DefaultPriority;
+    // Cancelled requests go first: their tasks exit right away and release
+    // the field load state.
+    if(r.field->cancelled) return numeric_limits<float>::max();
+    return r.field->getEffectivePriority(now);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+void LoadScheduler::refresh(double now)
+{
+    // Re-inserting in the current order keeps queue order among ties.
+    RequestMap pending;
+    for(RequestMap::iterator it = myPending.begin(); it != myPending.end(); it++)
+    {
+        pending.insert(RequestMap::value_type(getPriority(it->second, now), it->second));
+    }
+    myPending.swap(pending);
+    myRefreshStamp = now;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+bool LoadScheduler::pop(Request* r)
+{
+    AutoLock al(myLock);
+    if(myPending.empty()) return false;
+
+    double now = otimestamp();
+    if(now - myRefreshStamp > REFRESH_INTERVAL) refresh(now);
+
+    // Priorities decay as requests wait: if the first request dropped below
+    // the next one, move it to its place and check the new first one. Keys 
+    // only decrease here, so this ends.
+    for(;;)
+    {
+        RequestMap::iterator first = myPending.begin();
+        float p = getPriority(first->second, now);
+        RequestMap::iterator next = first;
+        next++;
+        if(p >= first->first || next == myPending.end() || p >= next->first)
+        {
+            *r = first->second;
+            myPending.erase(first);
+            return true;
+        }
+        Request moved = first->second;
+        myPending.erase(first);
+        myPending.insert(RequestMap::value_type(p, moved));
+    }
+}
@@ -0,0 +1,70 @@
+#ifndef __LOAD_SCHEDULER__
+#define __LOAD_SCHEDULER__
+
+#include <omega.h>
+#include "Dataset.h"
+
+#include <map>
+#include <functional>
+
+using namespace omega;
+
+///////////////////////////////////////////////////////////////////////////////
+//! A worker pool for field loads that runs pending tasks in order of field
+//! priority instead of queue order. Pending requests are kept ordered by
+//! priority. Priorities only change outside the scheduler, so the order is
+//! updated lazily: the first request is checked against its current priority
+//! when a worker becomes free, and the whole order is refreshed at a fixed
+//! interval to pick up raised priorities. Requests for cancelled fields are
+//! run first so their tasks can exit and reset the field state.
+class LoadScheduler : public ReferenceType
+{
+public:
+    LoadScheduler();
+    ~LoadScheduler();
+
+    void start(int threads);
+    void stop();
+    void clearQueue();
+
+    //! Queues a task loading the field f. f can be NULL for tasks not tied to
+    //! a field: they run at Field::DefaultPriority.
+    void queue(WorkerTask* task, Field* f);
+    size_t getNumPending();
+
+private:
+    struct Request
+    {
+        Ref<WorkerTask> task;
+        Ref<Field> field;
+    };
+
+    // Worker pool task that runs the most important pending request.
+    class Dispatcher : public WorkerTask
+    {
+    public:
+        Dispatcher(LoadScheduler* owner) : myOwner(owner) {}
+        void execute(WorkerTask::TaskInfo* ti);
+    private:
+        LoadScheduler* myOwner;
+    };
+
+    // Pending requests by priority, highest first. Requests with the same
+    // priority are kept in queue order.
+    typedef std::multimap<float, Request, std::greater<float> > RequestMap;
+
+    bool pop(Request* r);
+    //! Returns the current priority of a request.
+    float getPriority(const Request& r, double now);
+    //! Orders all pending requests by their current priority.
+    void refresh(double now);
+
+private:
+    WorkerPool myPool;
+    Ref<Dispatcher> myDispatcher;
+    Lock myLock;
+    RequestMap myPending;
+    double myRefreshStamp;
+};
+
+#endif
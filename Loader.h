@@ -14,5 +14,8 @@ public:
 
     virtual size_t getNumRecords(Dataset* d) { return 0; }
     virtual bool getBounds(const Domain& d, float* bounds) { return false; }
+    //! Returns the file the loader reads data from, or an empty string if 
+    //! data does not come from a file.
+    virtual String getSource() { return ""; }
 };
 #endif
\ No newline at end of file
@@ -0,0 +1,85 @@
+#include "Monitor.h"
+
+#ifdef OMEGA_OS_WIN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <pthread.h>
+#endif
+
+///////////////////////////////////////////////////////////////////////////////
+struct Monitor::Impl
+{
+#ifdef OMEGA_OS_WIN
+    CRITICAL_SECTION mutex;
+    CONDITION_VARIABLE condition;
+#else
+    pthread_mutex_t mutex;
+    pthread_cond_t condition;
+#endif
+};
+
+///////////////////////////////////////////////////////////////////////////////
+Monitor::Monitor():
+    myImpl(new Impl())
+{
+#ifdef OMEGA_OS_WIN
+    InitializeCriticalSection(&myImpl->mutex);
+    InitializeConditionVariable(&myImpl->condition);
+#else
+    pthread_mutex_init(&myImpl->mutex, NULL);
+    pthread_cond_init(&myImpl->condition, NULL);
+#endif
+}
+
+///////////////////////////////////////////////////////////////////////////////
+Monitor::~Monitor()
+{
+#ifdef OMEGA_OS_WIN
+    DeleteCriticalSection(&myImpl->mutex);
+#else
+    pthread_cond_destroy(&myImpl->condition);
+    pthread_mutex_destroy(&myImpl->mutex);
+#endif
+    delete myImpl;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+void Monitor::lock()
+{
+#ifdef OMEGA_OS_WIN
+    EnterCriticalSection(&myImpl->mutex);
+#else
+    pthread_mutex_lock(&myImpl->mutex);
+#endif
+}
+
+///////////////////////////////////////////////////////////////////////////////
+void Monitor::unlock()
+{
+#ifdef OMEGA_OS_WIN
+    LeaveCriticalSection(&myImpl->mutex);
+#else
+    pthread_mutex_unlock(&myImpl->mutex);
+#endif
+}
+
+///////////////////////////////////////////////////////////////////////////////
+void Monitor::wait()
+{
+#ifdef OMEGA_OS_WIN
+    SleepConditionVariableCS(&myImpl->condition, &myImpl->mutex, INFINITE);
+#else
+    pthread_cond_wait(&myImpl->condition, &myImpl->mutex);
+#endif
+}
+
+///////////////////////////////////////////////////////////////////////////////
+void Monitor::notifyAll()
+{
+#ifdef OMEGA_OS_WIN
+    WakeAllConditionVariable(&myImpl->condition);
+#else
+    pthread_cond_broadcast(&myImpl->condition);
+#endif
+}
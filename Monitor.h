@@ -0,0 +1,32 @@
+#ifndef __MONITOR__
+#define __MONITOR__
+
+#include <omega.h>
+
+using namespace omega;
+
+///////////////////////////////////////////////////////////////////////////////
+//! A lock with a condition. Threads holding the lock can wait until another
+//! thread changes the state the lock protects and notifies them, without
+//! polling.
+class Monitor
+{
+public:
+    Monitor();
+    ~Monitor();
+
+    void lock();
+    void unlock();
+    //! Releases the lock, waits for a notification and takes the lock again.
+    //! Call with the lock held. Waits can end without a notification: check
+    //! the waited for state again.
+    void wait();
+    //! Wakes up all waiting threads.
+    void notifyAll();
+
+private:
+    struct Impl;
+    Impl* myImpl;
+};
+
+#endif
@@ -2,6 +2,7 @@
 
 #include "NumpyLoader.h"
 #include  "signac.h"
+#include "FieldAllocator.h"
 
 ///////////////////////////////////////////////////////////////////////////////
 NumpyLoader::NumpyLoader()
@@ -71,7 +72,7 @@ void NumpyLoader::load(Field* f)
         f->lock.lock();
                 
         // Allocate field data
-        float* fielddata = (float*)malloc((slen / sstride) * sizeof(float));
+        float* fielddata = (float*)FieldAllocator::allocate((slen / sstride) * sizeof(float));
         
         size_t c = 0;
         for(size_t i = sstart; i < sstart + slen; i += sstride)
@@ -83,8 +84,9 @@ void NumpyLoader::load(Field* f)
         // Update field length
         f->data = (char*)fielddata;
         f->loaded = true;
-        f->stamp = otimestamp();
+        f->dataChanged();
         f->lock.unlock();
+        dim->dataset->loadCompleted(f);
         
         ofmsg("Loaded field %1% %2% %3%", %dim->id %sstart %slen);
 
@@ -93,5 +95,6 @@ void NumpyLoader::load(Field* f)
     else
     {
         ofwarn("[NumpyLoader::load] could not find dimension <%1%>", %dim->id);
+        dim->dataset->loadFailed(f);
     }
 }
@@ -12,6 +12,15 @@
 #define VA_VECTOR_DATA_X 6
 #define VA_VECTOR_DATA_Y 7
 #define VA_VECTOR_DATA_Z 8
+#define VA_INDEX 9
+
+// Priority scale of prefetched drawables. Keeps prefetch loads behind the
+// loads of drawables visible in the current frame.
+#define PREFETCH_PRIORITY_SCALE 0.25f
+// Priority boost of the color (data) and filter fields: when they change the
+// position fields are usually loaded already, and these are what the user is
+// waiting for.
+#define DATA_PRIORITY_BOOST 2.0f
 
 ///////////////////////////////////////////////////////////////////////////////
 bool LOD::parse(const String& options, Vector<LOD>* lodlevels, size_t* pointsPerBatch)
@@ -41,70 +50,124 @@ bool LOD::parse(const String& options, Vector<LOD>* lodlevels, size_t* pointsPer
 
 ///////////////////////////////////////////////////////////////////////////////
 PointBatch::PointBatch(PointCloud* owner) :
-    myOwner(owner) {}
+    myOwner(owner),
+    myHasBounds(false) {}
 
 ///////////////////////////////////////////////////////////////////////////////
 void PointBatch::addDrawable(LOD* lod, size_t start, size_t length)
 {
-    // The first drawable added will be used to compute the bounds of this point
-    // batch.
-    if(myDrawables.empty())
-    {
-        float bounds[14];
-        Loader* l = myOwner->getDataset()->getLoader();
-        l->getBounds(Domain(start, length, lod->dec), bounds);
+    myDrawables.push_back(new BatchDrawable(this, lod, start, length));
+}
+
+///////////////////////////////////////////////////////////////////////////////
+bool PointBatch::computeBounds(float* bounds)
+{
+    // The first drawable is used to compute the bounds of this point batch.
+    BatchDrawable* bd = myDrawables.front();
+    Loader* l = myOwner->getDataset()->getLoader();
+    return l->getBounds(Domain(bd->batchStart, bd->batchLength, bd->LOD->dec), bounds);
+}
 
-        // Extend the point cloud bounding box with this batch corners
-        myBBox.merge(Vector3f(bounds[0], bounds[2], bounds[4]));
-        myBBox.merge(Vector3f(bounds[1], bounds[3], bounds[5]));
+///////////////////////////////////////////////////////////////////////////////
+void PointBatch::setBounds(const float* bounds)
+{
+    AutoLock al(myBoundsLock);
+    myBBox.setNull();
+    myBBox.merge(Vector3f(bounds[0], bounds[2], bounds[4]));
+    myBBox.merge(Vector3f(bounds[1], bounds[3], bounds[5]));
+    memcpy(myColumnBounds, bounds, sizeof(myColumnBounds));
+    myHasBounds = true;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Points a drawable field reference to field f. If the previous field is not
+// used by any drawable anymore, its pending load is cancelled.
+static void setDrawableField(Dataset* ds, Ref<Field>& field, Field* f)
+{
+    Field* old = field;
+    if(f == old) return;
+
+    if(f != NULL) f->addUser();
+    field = f;
+    if(old != NULL && old->removeUser() == 0) ds->cancel(old);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+PointBatch::~PointBatch()
+{
+    // Release the drawable fields, cancelling the loads nobody else needs.
+    // Batches are destroyed before the point cloud dataset.
+    Dataset* ds = myOwner->getDataset();
+    foreach(BatchDrawable* bd, myDrawables)
+    {
+        setDrawableField(ds, bd->x, NULL);
+        setDrawableField(ds, bd->y, NULL);
+        setDrawableField(ds, bd->z, NULL);
+        setDrawableField(ds, bd->data, NULL);
+        setDrawableField(ds, bd->filter, NULL);
+        setDrawableField(ds, bd->size, NULL);
+        setDrawableField(ds, bd->datax, NULL);
+        setDrawableField(ds, bd->datay, NULL);
+        setDrawableField(ds, bd->dataz, NULL);
     }
-    myDrawables.push_back(new BatchDrawable(this, lod, start, length));
 }
 
 ///////////////////////////////////////////////////////////////////////////////
 void PointBatch::refreshFields()
 {
     Dataset* ds = myOwner->getDataset();
+    Dimension* dims[9] = {
+        myOwner->getX(), myOwner->getY(), myOwner->getZ(),
+        myOwner->getData(), myOwner->getFilter(), myOwner->getSize(),
+        myOwner->getDataX(), myOwner->getDataY(), myOwner->getDataZ() };
+    Field* fields[9];
+
     foreach(BatchDrawable* bd, myDrawables)
     {
         Domain d(bd->batchStart, bd->batchLength, bd->LOD->dec);
-        bd->x = ds->getOrCreateField(myOwner->getX(), d);
-        bd->y = ds->getOrCreateField(myOwner->getY(), d);
-        bd->z = ds->getOrCreateField(myOwner->getZ(), d);
-
-        Dimension* dim;
-        
-        dim = myOwner->getData();
-        bd->data = dim != NULL ? ds->getOrCreateField(dim, d) : NULL;
-        dim = myOwner->getFilter();
-        bd->filter = dim != NULL ? ds->getOrCreateField(dim, d) : NULL;
-        dim = myOwner->getSize();
-        bd->size = dim != NULL ? ds->getOrCreateField(dim, d) : NULL;
-
-        dim = myOwner->getDataX();
-        bd->datax = dim != NULL ? ds->getOrCreateField(dim, d) : NULL;
-        dim = myOwner->getDataY();
-        bd->datay = dim != NULL ? ds->getOrCreateField(dim, d) : NULL;
-        dim = myOwner->getDataZ();
-        bd->dataz = dim != NULL ? ds->getOrCreateField(dim, d) : NULL;
+        ds->getOrCreateFields(dims, 9, d, fields);
+
+        setDrawableField(ds, bd->x, fields[0]);
+        setDrawableField(ds, bd->y, fields[1]);
+        setDrawableField(ds, bd->z, fields[2]);
+
+        setDrawableField(ds, bd->data, fields[3]);
+        setDrawableField(ds, bd->filter, fields[4]);
+        setDrawableField(ds, bd->size, fields[5]);
+
+        setDrawableField(ds, bd->datax, fields[6]);
+        setDrawableField(ds, bd->datay, fields[7]);
+        setDrawableField(ds, bd->dataz, fields[8]);
     }
 }
 
 ///////////////////////////////////////////////////////////////////////////////
-bool PointBatch::hasBoundingBox()
+// Returns true if the drawable position fields are loaded and have bounds.
+static bool hasFieldBounds(BatchDrawable* bd)
 {
-    BatchDrawable* bd = myDrawables.front();
     return bd != NULL && bd->x != NULL && bd->x->loaded &&
         bd->y != NULL && bd->y->loaded &&
-        bd->z != NULL && bd->z->loaded;
+        bd->z != NULL && bd->z->loaded &&
+        bd->x->boundMin <= bd->x->boundMax &&
+        bd->y->boundMin <= bd->y->boundMax &&
+        bd->z->boundMin <= bd->z->boundMax;
 }
 
 ///////////////////////////////////////////////////////////////////////////////
-const AlignedBox3& PointBatch::getBoundingBox()
+bool PointBatch::hasBoundingBox()
 {
-    if(hasBoundingBox())
+    if(hasFieldBounds(myDrawables.front())) return true;
+    AutoLock al(myBoundsLock);
+    return myHasBounds;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+AlignedBox3 PointBatch::getBoundingBox()
+{
+    AutoLock al(myBoundsLock);
+    BatchDrawable* bd = myDrawables.front();
+    if(hasFieldBounds(bd))
     {
-        BatchDrawable* bd = myDrawables.front();
         myBBox.setExtents(
             bd->x->boundMin,
             bd->y->boundMin,
@@ -117,11 +180,198 @@ const AlignedBox3& PointBatch::getBoundingBox()
 }
 
 ///////////////////////////////////////////////////////////////////////////////
-void PointBatch::draw(const DrawContext& dc)
+float PointBatch::getDistance(const Vector3f& pos)
+{
+    AlignedBox3 bb = getBoundingBox();
+    if(bb.isNull()) return 0;
+
+    // Distance from the closest point of the box.
+    Vector3f d = pos.cwiseMax(bb.getMinimum()).cwiseMin(bb.getMaximum()) - pos;
+    return d.norm();
+}
+
+///////////////////////////////////////////////////////////////////////////////
+BatchDrawable* PointBatch::getDrawable(float dist)
 {
-    // For now just draw first LOD.
+    // Use the first LOD if we are closer than any LOD range, the last one if
+    // we are farther.
     BatchDrawable* bd = myDrawables.front();
+    foreach(BatchDrawable* d, myDrawables)
+    {
+        if(dist < d->LOD->distmin) break;
+        bd = d;
+        if(dist < d->LOD->distmax) break;
+    }
+    return bd;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Fills fields with the fields used by a drawable. Returns the field count.
+static int getDrawableFields(BatchDrawable* bd, Field** fields)
+{
+    int n = 0;
+    if(bd->x != NULL) fields[n++] = bd->x;
+    if(bd->y != NULL) fields[n++] = bd->y;
+    if(bd->z != NULL) fields[n++] = bd->z;
+    if(bd->data != NULL) fields[n++] = bd->data;
+    if(bd->size != NULL) fields[n++] = bd->size;
+    if(bd->filter != NULL) fields[n++] = bd->filter;
+    if(bd->datax != NULL) fields[n++] = bd->datax;
+    if(bd->datay != NULL) fields[n++] = bd->datay;
+    if(bd->dataz != NULL) fields[n++] = bd->dataz;
+    return n;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+bool PointBatch::isLoaded(BatchDrawable* bd)
+{
+    Field* fields[9];
+    int n = getDrawableFields(bd, fields);
+    if(n == 0) return false;
+    for(int i = 0; i < n; i++)
+    {
+        if(!fields[i]->loaded) return false;
+    }
+    return true;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+bool PointBatch::isLoadFailed(BatchDrawable* bd)
+{
+    Field* fields[9];
+    int n = getDrawableFields(bd, fields);
+    for(int i = 0; i < n; i++)
+    {
+        if(fields[i]->failed) return true;
+    }
+    return false;
+}
 
+///////////////////////////////////////////////////////////////////////////////
+void PointBatch::prefetch(BatchDrawable* bd, float dist)
+{
+    if(isFilteredOut(bd)) return;
+    requestPriority(bd, dist, PREFETCH_PRIORITY_SCALE);
+
+    Dataset* ds = myOwner->getDataset();
+    Field* fields[9];
+    int n = getDrawableFields(bd, fields);
+    for(int i = 0; i < n; i++)
+    {
+        if(!fields[i]->loaded && !fields[i]->failed) ds->load(fields[i]);
+    }
+}
+
+///////////////////////////////////////////////////////////////////////////////
+void PointBatch::requestPriority(BatchDrawable* bd, float dist, float scale)
+{
+    // Approximate the projected batch size with the bounding sphere radius
+    // over the eye distance. This is 1 when the eye is inside the batch.
+    float size = 1.0f;
+    AlignedBox3 bb = getBoundingBox();
+    if(!bb.isNull())
+    {
+        float r = bb.getHalfSize().norm();
+        if(r > 0) size = r / (r + dist);
+    }
+
+    // Closer LOD levels come first in the list and are more important.
+    int lodIndex = 0;
+    foreach(BatchDrawable* d, myDrawables)
+    {
+        if(d == bd) break;
+        lodIndex++;
+    }
+    float p = size / (1 + lodIndex);
+
+    // Drawables needed for this frame go in a band above all prefetches.
+    float base = scale < 1.0f ? 0.0f : 1.0f;
+
+    Field* fields[9];
+    int n = getDrawableFields(bd, fields);
+    for(int i = 0; i < n; i++)
+    {
+        Field* f = fields[i];
+        if(f->loaded) continue;
+        float fp = p;
+        if(f == bd->data || f == bd->filter) fp *= DATA_PRIORITY_BOOST;
+        f->requestPriority(base + fp * scale);
+    }
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Gets the filter bounds of the point cloud, in filter dimension units.
+static void getFilterBounds(ProgramParams* pp, Dimension* dim, float* fmin, float* fmax)
+{
+    *fmin = pp->filterMin;
+    *fmax = pp->filterMax;
+    if(pp->normalizedFilterBounds)
+    {
+        float l = dim->floatRangeMax - dim->floatRangeMin;
+        *fmin = *fmin * l + dim->floatRangeMin;
+        *fmax = *fmax * l + dim->floatRangeMin;
+    }
+}
+
+///////////////////////////////////////////////////////////////////////////////
+bool PointBatch::isFilteredOut(BatchDrawable* bd)
+{
+    Dimension* dim = myOwner->getFilter();
+    if(dim == NULL) return false;
+
+    // Get the filter dimension range in this batch. Use the filter field 
+    // bounds if the field is loaded (the zone maps of partially loaded fields
+    // only cover part of the batch), the loader bounds otherwise. Loader 
+    // bounds are ordered by dimension index.
+    double bmin, bmax;
+    Field* ff = bd->filter;
+    if(ff != NULL && ff->loaded && ff->getNumZones() > 0 && ff->boundMin <= ff->boundMax)
+    {
+        // NaN values always pass the filter.
+        if(ff->hasNaN()) return false;
+        bmin = ff->boundMin;
+        bmax = ff->boundMax;
+    }
+    else
+    {
+        AutoLock al(myBoundsLock);
+        if(!myHasBounds || dim->index >= 7) return false;
+        bmin = myColumnBounds[dim->index * 2];
+        bmax = myColumnBounds[dim->index * 2 + 1];
+    }
+
+    float fmin, fmax;
+    getFilterBounds(myOwner->myProgramParams, dim, &fmin, &fmax);
+    return bmax < fmin || bmin > fmax;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+bool PointBatch::draw(const DrawContext& dc, const Vector3f& eye)
+{
+    float dist = getDistance(eye);
+    BatchDrawable* bd = getDrawable(dist);
+    // Skip batches the filter removes entirely: they are not drawn nor loaded.
+    if(isFilteredOut(bd)) return false;
+    requestPriority(bd, dist, 1.0f);
+    if(!drawDrawable(dc, bd))
+    {
+        // The LOD we want is still loading: draw one that is ready instead, so
+        // the batch does not disappear while data streams in.
+        foreach(BatchDrawable* d, myDrawables)
+        {
+            if(d != bd && isLoaded(d))
+            {
+                drawDrawable(dc, d);
+                break;
+            }
+        }
+    }
+    return true;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+bool PointBatch::drawDrawable(const DrawContext& dc, BatchDrawable* bd)
+{
     Program* p = myOwner->getProgram();
     // Initialize the texture and render target (if needed)
     if(bd->drawCall(dc) == NULL)
@@ -229,6 +479,31 @@ void PointBatch::draw(const DrawContext& dc)
 
     if(fdx != NULL && fdy != NULL && fdz != NULL) hasVectorData = true;
 
+    // The buffers of growing fields can hold fewer elements than the fields
+    // while their uploads wait for budget: draw the elements all buffers 
+    // hold. Selection indices address the whole fields, so drawables with a
+    // selection wait for the uploads.
+    size_t gpuLength = l;
+    if(readyToDraw)
+    {
+        Field* fields[9];
+        int n = getDrawableFields(bd, fields);
+        for(int i = 0; i < n; i++) gpuLength = min(gpuLength, fields[i]->getGpuLength(dc));
+    }
+
+    // Selection. Drawables without a selection result are not drawn, so the
+    // batch falls back to a LOD level that has one.
+    DatasetFilter* sel = myOwner->getSelection();
+    bool hasSelection = sel != NULL && sel->isEnabled();
+    Ref<Bitmap> selection;
+    double selectionStamp = 0;
+    if(hasSelection)
+    {
+        Domain d(bd->batchStart, bd->batchLength, bd->LOD->dec);
+        readyToDraw &= gpuLength == l && sel->getResult(d, selection, &selectionStamp);
+    }
+    l = gpuLength;
+
     if(readyToDraw)
     {
         bd->va(dc)->setBuffer(VA_X, xgpubuf);
@@ -249,15 +524,8 @@ void PointBatch::draw(const DrawContext& dc)
         {
             bd->va(dc)->setBuffer(VA_FILTER, filterbuf);
             Dimension* dim = bd->filter->getDimension();
-            ProgramParams* pp = myOwner->myProgramParams;
-            float fmin = pp->filterMin;
-            float fmax = pp->filterMax;
-            if(pp->normalizedFilterBounds)
-            {
-                float l = dim->floatRangeMax - dim->floatRangeMin;
-                fmin = fmin * l + dim->floatRangeMin;
-                fmax = fmax * l + dim->floatRangeMin;
-            }
+            float fmin, fmax;
+            getFilterBounds(myOwner->myProgramParams, dim, &fmin, &fmax);
             p->getFilterBounds(dc)->set(fmin, fmax);
         }
         if(hasVectorData)
@@ -266,6 +534,29 @@ void PointBatch::draw(const DrawContext& dc)
             bd->va(dc)->setBuffer(VA_VECTOR_DATA_Y, dataybuf);
             bd->va(dc)->setBuffer(VA_VECTOR_DATA_Z, datazbuf);
         }
+        if(hasSelection)
+        {
+            if(bd->selection(dc) == NULL)
+            {
+                bd->selection(dc) = dc.gpuContext->createVertexBuffer();
+                bd->selection(dc)->setType(GpuBuffer::IndexData);
+            }
+            if(bd->selection.stamp(dc) < selectionStamp)
+            {
+                bd->selection.stamp(dc) = selectionStamp;
+                // Selections are per batch, so their indices are batch-local.
+                uint n = (uint)selection->getCardinality();
+                Vector<uint> indices(n + 1);
+                selection->toIndices(&indices[0]);
+                bd->selection(dc)->setData(n * sizeof(uint), &indices[0]);
+            }
+            bd->va(dc)->setBuffer(VA_INDEX, bd->selection(dc));
+            l = (uint)selection->getCardinality();
+        }
+        else
+        {
+            bd->va(dc)->setBuffer(VA_INDEX, NULL);
+        }
 
         Transform3 mvmat = dc.modelview * myOwner->getOwner()->getFullTransform();
 
@@ -280,4 +571,5 @@ void PointBatch::draw(const DrawContext& dc)
         bd->drawCall(dc)->items = static_cast<uint>(l);
         bd->drawCall(dc)->run();
     }
+    return readyToDraw;
 }
@@ -54,6 +54,8 @@ public:
     GpuRef<GpuDrawCall> drawCall;
     GpuRef<GpuArray> va;
     GpuRef<Texture> colormap;
+    // Indices of the points selected by the point cloud selection filter.
+    GpuRef<GpuBuffer> selection;
 };
 
 ///////////////////////////////////////////////////////////////////////////////
@@ -61,18 +63,55 @@ class PointBatch : public ReferenceType
 {
 public:
     PointBatch(PointCloud* owner);
+    ~PointBatch();
 
     void addDrawable(LOD* lod, size_t start, size_t length);
 
+    //! Gets the batch bounds from the dataset loader, as min,max pairs for
+    //! x,y,z,r,g,b,a. Thread safe: called by workers during point cloud setup.
+    bool computeBounds(float* bounds);
+    //! Sets the batch bounding box from bounds computed by computeBounds.
+    //! Thread safe: bounds are handed over under the batch bounds lock.
+    void setBounds(const float* bounds);
+
     bool hasBoundingBox();
-    const AlignedBox3& getBoundingBox();
+    //! Returns a copy of the batch bounding box.
+    AlignedBox3 getBoundingBox();
+    //! Returns the distance of pos from the batch bounding box (0 if inside).
+    float getDistance(const Vector3f& pos);
+    //! Returns the drawable whose LOD distance range contains dist.
+    BatchDrawable* getDrawable(float dist);
+    //! Returns true if all the fields used by the drawable are loaded.
+    bool isLoaded(BatchDrawable* bd);
+    //! Returns true if a field used by the drawable failed to load.
+    bool isLoadFailed(BatchDrawable* bd);
+    //! Queues low priority loads for the fields of the drawable that are not 
+    //! in memory yet. dist is the expected eye distance from the batch.
+    void prefetch(BatchDrawable* bd, float dist);
     void refreshFields();
-    void draw(const DrawContext& c);
+    //! Returns true if no point of the drawable can pass the point cloud 
+    //! filter bounds, based on the filter field zone map or loader bounds.
+    bool isFilteredOut(BatchDrawable* bd);
+    //! Draws the batch. Returns false if the batch was skipped.
+    bool draw(const DrawContext& c, const Vector3f& eye);
+
+private:
+    bool drawDrawable(const DrawContext& c, BatchDrawable* bd);
+    //! Sets the load priority of the drawable fields, based on the batch 
+    //! screen size, LOD level and field role. scale lowers the priority of
+    //! drawables that are not needed for the current frame.
+    void requestPriority(BatchDrawable* bd, float dist, float scale);
 
 private:
     PointCloud* myOwner;
     List< Ref<BatchDrawable> > myDrawables;
+    // Protects the bounding box and column bounds, set by the point cloud
+    // update and read while drawing.
+    Lock myBoundsLock;
     AlignedBox3 myBBox;
+    bool myHasBounds;
+    // Loader bounds of each column, as min,max pairs.
+    float myColumnBounds[14];
 };
 
 #endif
\ No newline at end of file
@@ -2,9 +2,82 @@
 #include "PointCloud.h"
 #include "Loader.h"
 
+// Number of batch bounds computed in each run of a bounds task.
+#define BATCH_BOUNDS_PER_TASK 256
+
+///////////////////////////////////////////////////////////////////////////////
+// Computes the bounds of point cloud batches on the signac workers. Bounds
+// are computed a few batches at a time, requeuing the task after each run so
+// field loads queued in the meantime can run.
+// The task does not keep its point cloud alive: the point cloud cancels the
+// task and clears its back pointer when it is destroyed.
+class BatchBoundsTask : public WorkerTask
+{
+public:
+    // Held while a run computes bounds, and while the point cloud cancels 
+    // the task.
+    Lock lock;
+    PointCloud* cloud;
+    Vector< Ref<PointBatch> > batches;
+    size_t next;
+    //! Set when the point cloud does not need these bounds anymore.
+    bool cancelled;
+
+    BatchBoundsTask(): cloud(NULL), next(0), cancelled(false) {}
+
+    //! Stops the task and releases its batches. If detach is set, the point
+    //! cloud is being destroyed: the task releases it too.
+    void cancel(bool detach)
+    {
+        AutoLock al(lock);
+        cancelled = true;
+        batches.clear();
+        if(detach) cloud = NULL;
+    }
+
+    void execute(WorkerTask::TaskInfo* ti)
+    {
+        AutoLock al(lock);
+        if(!cancelled && cloud != NULL)
+        {
+            size_t end = min(next + BATCH_BOUNDS_PER_TASK, batches.size());
+            Vector<PointCloud::BatchBounds> results(end - next);
+            for(size_t i = 0; next < end; next++, i++)
+            {
+                results[i].batch = batches[next];
+                results[i].valid = batches[next]->computeBounds(results[i].bounds);
+            }
+            cloud->boundsComputed(this, results);
+
+            if(next < batches.size())
+            {
+                Signac::instance->addTask(this);
+                return;
+            }
+        }
+        // Done: release the point cloud and its batches.
+        cloud = NULL;
+        batches.clear();
+    }
+};
+
+///////////////////////////////////////////////////////////////////////////////
+PointCloud::~PointCloud()
+{
+    // Batches are released with the point cloud alive: they cancel their
+    // field loads through the point cloud dataset.
+    myBoundsLock.lock();
+    Ref<WorkerTask> task = myBoundsTask;
+    myBoundsLock.unlock();
+    if(task != NULL) ((BatchBoundsTask*)task.get())->cancel(true);
+}
+
 ///////////////////////////////////////////////////////////////////////////////
 PointCloud::PointCloud(const String& name) : NodeComponent(),
-myVisible(true)
+myVisible(true),
+myHasFocusPosition(false),
+myNumBatches(0),
+myNumBatchBounds(0)
 {
     float maxf = numeric_limits<float>::max();
     float minf = -numeric_limits<float>::max();
@@ -12,6 +85,7 @@ myVisible(true)
     myMinDataBounds = Vector4f(maxf, maxf, maxf, maxf);
     myMaxDataBounds = Vector4f(minf, minf, minf, minf);
     myProgramParams = new ProgramParams();
+    myPrefetcher = new Prefetcher();
 
     myBatchDrawStat = Stat::create(ostr("%1% batches", %name), StatsManager::Primitive);
 }
@@ -48,11 +122,33 @@ bool PointCloud::setDimensions(Dimension* x, Dimension* y, Dimension* z)
         %numRecords
         %myPointsPerBatch);
 
+    // Cancel bounds computations for batches created by previous calls. The
+    // task lock is taken without the bounds lock: running tasks hold it while
+    // they hand over their results.
+    myBoundsLock.lock();
+    Ref<WorkerTask> oldTask = myBoundsTask;
+    myBoundsLock.unlock();
+    if(oldTask != NULL) ((BatchBoundsTask*)oldTask.get())->cancel(false);
+
+    myBoundsLock.lock();
+    BatchBoundsTask* task = new BatchBoundsTask();
+    task->cloud = this;
+    myBoundsTask = task;
+    myPendingBounds.clear();
+    myNumBatchBounds = 0;
+    myBoundsLock.unlock();
+
+    // Batches of previous calls are replaced. Releasing them releases their
+    // fields.
+    myBatches.clear();
+    myBBox.setNull();
+
     // Iterate for each batch
-    for(size_t start = 0; start <= numRecords; start += myPointsPerBatch)
+    for(size_t start = 0; start < numRecords; start += myPointsPerBatch)
     {
         PointBatch* batch = new PointBatch(this);
         myBatches.push_back(batch);
+        task->batches.push_back(batch);
 
         // Create LOD groups for each batch
         foreach(LOD& ll, myLODLevels)
@@ -68,6 +164,10 @@ bool PointCloud::setDimensions(Dimension* x, Dimension* y, Dimension* z)
 
     refreshFields();
 
+    // Compute batch bounds in the background.
+    myNumBatches = task->batches.size();
+    Signac::instance->addTask(task);
+
     return true;
 }
 
@@ -115,19 +215,42 @@ void PointCloud::refreshFields()
         else myProgram->define("DATA_MODE", "0");
     }
 
+    updateBounds();
+}
+
+///////////////////////////////////////////////////////////////////////////////
+void PointCloud::updateBounds()
+{
     myBBox.setNull();
-    if(getOwner() != NULL)
+    foreach(PointBatch* b, myBatches)
     {
-        foreach(PointBatch* b, myBatches)
-        {
-            if(b->hasBoundingBox())
-            {
-                // Batch bounding box is not ready at this point.
-                myBBox.merge(b->getBoundingBox());
-            }
-            getOwner()->requestBoundingBoxUpdate();
-        }
+        // Batches without a bounding box yet are merged once it is ready.
+        if(b->hasBoundingBox()) myBBox.merge(b->getBoundingBox());
     }
+    if(getOwner() != NULL) getOwner()->requestBoundingBoxUpdate();
+}
+
+///////////////////////////////////////////////////////////////////////////////
+void PointCloud::boundsComputed(WorkerTask* task, const Vector<BatchBounds>& bounds)
+{
+    AutoLock al(myBoundsLock);
+    // Ignore results of tasks cancelled while they were running.
+    if(task != myBoundsTask) return;
+    myPendingBounds.insert(myPendingBounds.end(), bounds.begin(), bounds.end());
+}
+
+///////////////////////////////////////////////////////////////////////////////
+float PointCloud::getSetupProgress()
+{
+    if(myBoundsTask == NULL) return 0;
+    if(myNumBatches == 0) return 1;
+    return (float)myNumBatchBounds / myNumBatches;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+bool PointCloud::isReady()
+{
+    return myBoundsTask != NULL && getSetupProgress() >= 1;
 }
 
 ///////////////////////////////////////////////////////////////////////////////
@@ -138,6 +261,10 @@ void PointCloud::draw(const DrawContext& c)
 
     Rectf viewRect(-1, -1, 2, 2);
 
+    // Eye position in point cloud space, used to pick batch LOD levels.
+    Transform3 mv = c.modelview * getOwner()->getFullTransform();
+    Vector3f eye = mv.inverse().translation();
+
     int bc = 0;
     foreach(PointBatch* b, myBatches)
     {
@@ -165,16 +292,14 @@ void PointCloud::draw(const DrawContext& c)
 
             if(br.intersects(viewRect))*/
             {
-                b->draw(c);
-                bc++;
+                if(b->draw(c, eye)) bc++;
             }
         }
         else
         {
             // If the batch drawable does not have a bounding box yet, just
             // draw it. Bounding box will be ready eventually.
-            b->draw(c);
-            bc++;
+            if(b->draw(c, eye)) bc++;
         }
     }
 
@@ -191,7 +316,51 @@ void PointCloud::setProgram(Program* p)
 ///////////////////////////////////////////////////////////////////////////////
 void PointCloud::update(const UpdateContext& ctx)
 {
+    // Apply batch bounds computed since the last update.
+    Vector<BatchBounds> bounds;
+    myBoundsLock.lock();
+    bounds.swap(myPendingBounds);
+    myBoundsLock.unlock();
+    if(!bounds.empty())
+    {
+        foreach(BatchBounds& bb, bounds)
+        {
+            if(bb.valid)
+            {
+                bb.batch->setBounds(bb.bounds);
+                myBBox.merge(bb.batch->getBoundingBox());
+            }
+        }
+        bool wasReady = myNumBatchBounds >= myNumBatches;
+        myNumBatchBounds += bounds.size();
+        if(getOwner() != NULL) getOwner()->requestBoundingBoxUpdate();
+
+        if(!wasReady && myNumBatchBounds >= myNumBatches && myReadyCommand.length() > 0)
+        {
+            PythonInterpreter* pi = SystemManager::instance()->getScriptInterpreter();
+            pi->queueCommand(myReadyCommand);
+        }
+    }
+
+    // Evaluate the selection on domains drawn without a result.
+    if(mySelection != NULL) mySelection->update();
+
     SceneNode* sn = getOwner();
+    if(sn == NULL || !isVisible()) return;
+
+    // Prefetch batches along the predicted camera path.
+    Camera* cam = Engine::instance()->getDefaultCamera();
+    Vector3f eye = sn->convertWorldToLocalPosition(cam->getPosition());
+    myPrefetcher->update(ctx, eye,
+        myHasFocusPosition ? &myProgramParams->focusPosition : NULL,
+        myBatches);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+void PointCloud::setPrefetch(int frames, int maxLoadsPerFrame)
+{
+    myPrefetcher->setLookahead(frames);
+    myPrefetcher->setMaxLoadsPerFrame(maxLoadsPerFrame);
 }
 
 ///////////////////////////////////////////////////////////////////////////////
@@ -223,6 +392,7 @@ void PointCloud::setColor(const Color& c)
 void PointCloud::setFocusPosition(const Vector3f d)
 {
     myProgramParams->focusPosition = d;
+    myHasFocusPosition = true;
 }
 
 ///////////////////////////////////////////////////////////////////////////////
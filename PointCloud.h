@@ -5,7 +5,9 @@
 
 #include "Dataset.h"
 #include "PointBatch.h"
+#include "Prefetcher.h"
 #include "Program.h"
+#include "DatasetFilter.h"
 
 using namespace omega;
 
@@ -13,14 +15,26 @@ using namespace omega;
 class PointCloud : public NodeComponent
 {
     friend class PointBatch;
+    friend class BatchBoundsTask;
 public:
     typedef List< Ref<PointCloud> > List;
     static PointCloud* create(const String& name) { return new PointCloud(name); }
 public:
     PointCloud(const String& name);
+    ~PointCloud();
 
     bool setOptions(const String& options);
+    //! Creates the point cloud batches. Batch bounds are computed in the
+    //! background: the point cloud bounding box grows as they become 
+    //! available.
     bool setDimensions(Dimension* x, Dimension* y, Dimension* z);
+    //! Returns the fraction of batch bounds computed so far (0 - 1).
+    float getSetupProgress();
+    //! Returns true when the bounds of all batches have been computed.
+    bool isReady();
+    //! Sets a python command run when the point cloud becomes ready (the
+    //! bounds of all its batches have been computed).
+    void setReadyCommand(const String& cmd) { myReadyCommand = cmd; }
     void setData(Dimension* fi);
     void setVectorData(Dimension* x, Dimension* y, Dimension* z);
     void setSize(Dimension* fi);
@@ -34,6 +48,10 @@ public:
     Dimension* getData() { return myData; }
     Dimension* getSize() { return mySize; }
     Dimension* getFilter() { return myFilter; }
+    //! Sets a dataset filter selecting the points to draw. NULL draws all
+    //! points.
+    void setSelection(DatasetFilter* f) { mySelection = f; }
+    DatasetFilter* getSelection() { return mySelection; }
 
     void setPointScale(float scale);
     void normalizeFilterBounds(bool enabled);
@@ -44,6 +62,9 @@ public:
     PixelData* getColormap() { return myColormap; }
     void setColor(const Color& c);
     void setFocusPosition(const Vector3f d);
+    //! Sets how many frames ahead of the camera batches get prefetched (0 
+    //! disables prefetching) and how many batches can be queued per frame.
+    void setPrefetch(int frames, int maxLoadsPerFrame);
 
     Dataset* getDataset() { return myDataset; }
     virtual void update(const UpdateContext& ctx);
@@ -59,7 +80,18 @@ public:
     void setVisible(bool v) { myVisible = v; }
 
 private:
+    // Batch bounds computed by a BatchBoundsTask.
+    struct BatchBounds
+    {
+        Ref<PointBatch> batch;
+        bool valid;
+        float bounds[14];
+    };
+
     void refreshFields();
+    //! Called by workers when the bounds of some batches are ready.
+    void boundsComputed(WorkerTask* task, const Vector<BatchBounds>& bounds);
+    void updateBounds();
 
 private:
     bool myVisible;
@@ -73,9 +105,12 @@ private:
     Ref<Dimension> myDataZ;
     Ref<Dimension> mySize;
     Ref<Dimension> myFilter;
+    Ref<DatasetFilter> mySelection;
     Ref<Program> myProgram;
     Ref<ProgramParams> myProgramParams;
     Ref<PixelData> myColormap;
+    Ref<Prefetcher> myPrefetcher;
+    bool myHasFocusPosition;
 
     size_t myPointsPerBatch;
 
@@ -83,8 +118,16 @@ private:
 
     ::List< Ref<PointBatch> > myBatches;
     AlignedBox3 myBBox;
+
+    // Batch bounds computation state
+    Ref<WorkerTask> myBoundsTask;
+    Lock myBoundsLock;
+    Vector<BatchBounds> myPendingBounds;
+    size_t myNumBatches;
+    size_t myNumBatchBounds;
     Vector4f myMinDataBounds;
     Vector4f myMaxDataBounds;
+    String myReadyCommand;
 
     Ref<Stat> myBatchDrawStat;
 };
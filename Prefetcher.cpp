@@ -0,0 +1,99 @@
+#include "Prefetcher.h"
+
+// Weight of the latest camera motion sample in the smoothed velocity.
+#define VELOCITY_SMOOTHING 0.3f
+
+///////////////////////////////////////////////////////////////////////////////
+struct PrefetchCandidate
+{
+    float score;
+    float dist;
+    PointBatch* batch;
+    BatchDrawable* drawable;
+
+    bool operator<(const PrefetchCandidate& rhs) const
+    {
+        return score < rhs.score;
+    }
+};
+
+///////////////////////////////////////////////////////////////////////////////
+Prefetcher::Prefetcher():
+    myLookahead(30),
+    myMaxLoadsPerFrame(8),
+    myHasEye(false),
+    myLastEye(Vector3f::Zero()),
+    myVelocity(Vector3f::Zero())
+{
+}
+
+///////////////////////////////////////////////////////////////////////////////
+void Prefetcher::update(const UpdateContext& context, const Vector3f& eye,
+    const Vector3f* focus, ::List< Ref<PointBatch> >& batches)
+{
+    if(myLookahead <= 0 || context.dt <= 0) return;
+
+    // Update the camera velocity estimate. Smooth it so a single jittery frame
+    // does not send the prediction far away.
+    if(myHasEye)
+    {
+        Vector3f v = (eye - myLastEye) / context.dt;
+        myVelocity = myVelocity * (1.0f - VELOCITY_SMOOTHING) + v * VELOCITY_SMOOTHING;
+    }
+    myLastEye = eye;
+    myHasEye = true;
+
+    // Extrapolate the camera trajectory. We sample the end and the middle of
+    // the lookahead window: batches close to either of them will be needed.
+    Vector3f ahead = eye + myVelocity * (context.dt * myLookahead);
+    Vector3f mid = (eye + ahead) * 0.5f;
+
+    // Only batches the camera can reach within the window are prefetched,
+    // or batches close enough to be drawn at the finest LOD. Farther batches
+    // are loaded when drawn: queuing them would fill the load budget with
+    // data that is not needed soon.
+    float travel = (ahead - eye).norm();
+
+    Vector<PrefetchCandidate> candidates;
+    foreach(PointBatch* b, batches)
+    {
+        // Batches without bounds yet have no meaningful distance.
+        if(!b->hasBoundingBox()) continue;
+
+        float dahead = b->getDistance(ahead);
+        float dmid = b->getDistance(mid);
+        float dist = min(dahead, dmid);
+
+        // The LOD level is chosen by the camera distance, but batches around
+        // the focus position are fetched first.
+        float score = dist;
+        if(focus != NULL) score = min(score, b->getDistance(*focus));
+
+        float radius = max(travel, (float)b->getDrawable(0)->LOD->distmax);
+        if(score > radius) continue;
+
+        // Both the LOD needed at the end of the window and the one needed
+        // half way are candidates (they are often the same).
+        // Drawables with fields that failed to load are skipped.
+        BatchDrawable* bd = b->getDrawable(dahead);
+        if(!b->isLoaded(bd) && !b->isLoadFailed(bd))
+        {
+            PrefetchCandidate c = { score, dahead, b, bd };
+            candidates.push_back(c);
+        }
+        BatchDrawable* bdmid = b->getDrawable(dmid);
+        if(bdmid != bd && !b->isLoaded(bdmid) && !b->isLoadFailed(bdmid))
+        {
+            PrefetchCandidate c = { score, dmid, b, bdmid };
+            candidates.push_back(c);
+        }
+    }
+
+    // Queue the closest candidates first, up to the per-frame limit.
+    size_t n = min(candidates.size(), (size_t)myMaxLoadsPerFrame);
+    std::partial_sort(candidates.begin(), candidates.begin() + n, candidates.end());
+    for(size_t i = 0; i < n; i++)
+    {
+        candidates[i].batch->prefetch(candidates[i].drawable, candidates[i].dist);
+    }
+}
@@ -0,0 +1,42 @@
+#ifndef __PREFETCHER__
+#define __PREFETCHER__
+
+#include <omega.h>
+
+#include "PointBatch.h"
+
+using namespace omega;
+
+///////////////////////////////////////////////////////////////////////////////
+//! Predicts where the camera will be over the next few frames and queues loads
+//! for the point batches (and LOD levels) that will be needed there, so data is
+//! resident before the batches are drawn. Only batches within the distance
+//! the camera travels over the lookahead window (or the finest LOD distance,
+//! if larger) of the predicted path or focus position are prefetched.
+class Prefetcher : public ReferenceType
+{
+public:
+    Prefetcher();
+
+    //! Number of frames to look ahead of the camera. 0 disables prefetching.
+    void setLookahead(int frames) { myLookahead = frames; }
+    int getLookahead() { return myLookahead; }
+    //! Maximum number of batch drawables queued for loading in one frame.
+    void setMaxLoadsPerFrame(int loads) { myMaxLoadsPerFrame = loads; }
+
+    //! Call once per frame with the eye position in point cloud space. If
+    //! focus is not NULL, batches close to it are prefetched first too.
+    void update(const UpdateContext& context, const Vector3f& eye,
+        const Vector3f* focus, ::List< Ref<PointBatch> >& batches);
+
+private:
+    int myLookahead;
+    int myMaxLoadsPerFrame;
+
+    bool myHasEye;
+    Vector3f myLastEye;
+    // Smoothed camera velocity, in point cloud units per second.
+    Vector3f myVelocity;
+};
+
+#endif
@@ -57,7 +57,11 @@ void PlotBrush::draw(Plot* plot, const DrawContext& dc)
     GpuBuffer* xgpubuf = fx->getGpuBuffer(dc);
     GpuBuffer* ygpubuf = fy->getGpuBuffer(dc);
 
-    if(xgpubuf != NULL && ygpubuf != NULL)
+    // Buffers of growing fields can lag behind the field data. Filter 
+    // indices address the whole fields, so filtered plots wait for uploads.
+    uint gpuLength = static_cast<uint>(min(fx->getGpuLength(dc), fy->getGpuLength(dc)));
+    bool filtered = myFilter != NULL && myFilter->hasSelection();
+    if(xgpubuf != NULL && ygpubuf != NULL && (!filtered || gpuLength >= l))
     {
         myVA(dc)->setBuffer(0, xgpubuf);
         myVA(dc)->setBuffer(1, ygpubuf);
@@ -82,15 +86,17 @@ void PlotBrush::draw(Plot* plot, const DrawContext& dc)
 
         }
 
-        if(myFilter != NULL && myFilter->getFilteredLength() != -1)
+        if(filtered)
         {
             myVA(dc)->setBuffer(2, myFilter->getIndexBuffer(dc));
-            myDrawCall(dc)->items = myFilter->getFilteredLength();
+            // The filter result can change after the upload: draw the
+            // uploaded indices.
+            myDrawCall(dc)->items = myFilter->getIndexLength(dc);
             myDrawCall(dc)->run();
         }
         else
         {
-            myDrawCall(dc)->items = l;
+            myDrawCall(dc)->items = min(l, gpuLength);
             myDrawCall(dc)->run();
         }
         oassert(!oglError);
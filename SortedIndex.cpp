@@ -0,0 +1,329 @@
+#include "SortedIndex.h"
+#include "Dataset.h"
+#include "Loader.h"
+#include "ComputePool.h"
+
+#include <algorithm>
+#include <sys/stat.h>
+
+#define SORTED_INDEX_MAGIC 0x58444953
+#define SORTED_INDEX_VERSION 2
+// Number of elements sorted by each task of the first sort pass.
+#define SORT_CHUNK_SIZE (1024 * 1024)
+
+///////////////////////////////////////////////////////////////////////////////
+// Orders element indices by value. NaN values sort after all other values,
+// and equal values by index, so the order is the same for any chunking.
+template<typename T> struct IndexLess
+{
+    const T* data;
+    bool operator()(uint a, uint b) const
+    {
+        T va = data[a];
+        T vb = data[b];
+        if(va < vb) return true;
+        if(vb < va) return false;
+        bool na = va != va;
+        bool nb = vb != vb;
+        if(na != nb) return nb;
+        return a < b;
+    }
+};
+
+///////////////////////////////////////////////////////////////////////////////
+// First sort pass: sorts the indices of each chunk.
+template<typename T> class SortChunkTask : public ParallelTask
+{
+public:
+    const T* data;
+    size_t size;
+    uint* order;
+
+    void run(size_t chunk)
+    {
+        size_t start = chunk * SORT_CHUNK_SIZE;
+        size_t end = min(start + SORT_CHUNK_SIZE, size);
+        for(size_t i = start; i < end; i++) order[i] = (uint)i;
+        IndexLess<T> less = { data };
+        std::sort(order + start, order + end, less);
+    }
+};
+
+///////////////////////////////////////////////////////////////////////////////
+// Merge pass: merges pairs of sorted runs of the given width from src to dst.
+template<typename T> class MergeTask : public ParallelTask
+{
+public:
+    const T* data;
+    size_t size;
+    size_t width;
+    const uint* src;
+    uint* dst;
+
+    void run(size_t pair)
+    {
+        size_t start = pair * width * 2;
+        size_t mid = min(start + width, size);
+        size_t end = min(start + width * 2, size);
+        IndexLess<T> less = { data };
+        std::merge(src + start, src + mid, src + mid, src + end, dst + start, less);
+    }
+};
+
+///////////////////////////////////////////////////////////////////////////////
+// Copies the values in permutation order.
+template<typename T> class GatherTask : public ParallelTask
+{
+public:
+    const T* data;
+    size_t size;
+    const uint* order;
+    T* values;
+
+    void run(size_t chunk)
+    {
+        size_t start = chunk * SORT_CHUNK_SIZE;
+        size_t end = min(start + SORT_CHUNK_SIZE, size);
+        for(size_t i = start; i < end; i++) values[i] = data[order[i]];
+    }
+};
+
+///////////////////////////////////////////////////////////////////////////////
+SortedIndex::SortedIndex(size_t elementSize, uint version):
+    myElementSize(elementSize),
+    myVersion(version),
+    myNumValid(0)
+{
+}
+
+///////////////////////////////////////////////////////////////////////////////
+template<typename T>
+void SortedIndex::sort(const T* data, size_t n)
+{
+    myOrder.resize(n);
+    myValues.resize(n * sizeof(T));
+    if(n == 0) return;
+
+    ComputePool* pool = ComputePool::instance();
+    size_t numChunks = (n + SORT_CHUNK_SIZE - 1) / SORT_CHUNK_SIZE;
+
+    SortChunkTask<T> sortTask;
+    sortTask.data = data;
+    sortTask.size = n;
+    sortTask.order = &myOrder[0];
+    pool->parallelFor(&sortTask, numChunks);
+
+    // Merge sorted runs, doubling their width at each pass.
+    Vector<uint> tmp(numChunks > 1 ? n : 0);
+    uint* src = &myOrder[0];
+    uint* dst = numChunks > 1 ? &tmp[0] : NULL;
+    for(size_t width = SORT_CHUNK_SIZE; width < n; width *= 2)
+    {
+        MergeTask<T> mergeTask;
+        mergeTask.data = data;
+        mergeTask.size = n;
+        mergeTask.width = width;
+        mergeTask.src = src;
+        mergeTask.dst = dst;
+        pool->parallelFor(&mergeTask, (n + width * 2 - 1) / (width * 2));
+        std::swap(src, dst);
+    }
+    if(src != &myOrder[0]) myOrder.swap(tmp);
+
+    GatherTask<T> gatherTask;
+    gatherTask.data = data;
+    gatherTask.size = n;
+    gatherTask.order = &myOrder[0];
+    gatherTask.values = (T*)&myValues[0];
+    pool->parallelFor(&gatherTask, numChunks);
+
+    const T* values = (const T*)&myValues[0];
+    myNumValid = n;
+    while(myNumValid > 0 && values[myNumValid - 1] != values[myNumValid - 1]) myNumValid--;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+SortedIndex* SortedIndex::build(Field* f)
+{
+    size_t elemSize = f->getDimension()->getElementSize();
+    size_t n = f->domain.length;
+    SortedIndex* idx = new SortedIndex(elemSize, f->version);
+    if(elemSize == sizeof(double)) idx->sort<double>((const double*)f->data, n);
+    else idx->sort<float>((const float*)f->data, n);
+    return idx;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// FNV-1a over 64 bit words.
+uint64_t SortedIndex::checksum(const char* data, size_t size)
+{
+    uint64_t h = 14695981039346656037ULL;
+    size_t words = size / sizeof(uint64_t);
+    for(size_t i = 0; i < words; i++)
+    {
+        uint64_t w;
+        memcpy(&w, data + i * sizeof(uint64_t), sizeof(uint64_t));
+        h = (h ^ w) * 1099511628211ULL;
+    }
+    for(size_t i = words * sizeof(uint64_t); i < size; i++)
+    {
+        h = (h ^ (unsigned char)data[i]) * 1099511628211ULL;
+    }
+    return h;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+bool SortedIndex::makeHeader(Field* f, const String& source, Header* h)
+{
+    struct stat st;
+    if(stat(source.c_str(), &st) != 0) return false;
+
+    memset(h, 0, sizeof(Header));
+    h->magic = SORTED_INDEX_MAGIC;
+    h->version = SORTED_INDEX_VERSION;
+    h->elementSize = (uint)f->getDimension()->getElementSize();
+    h->decimation = (uint)f->domain.decimation;
+    h->numElements = (uint64_t)f->domain.length;
+    h->sourceSize = (uint64_t)st.st_size;
+    h->sourceTime = (uint64_t)st.st_mtime;
+    h->domainStart = (uint64_t)f->domain.start;
+    h->domainLength = (uint64_t)f->domain.length;
+    // The source identity does not guarantee the same data: the index is
+    // only used if the data matches the data it was built for.
+    h->dataChecksum = checksum(f->data, f->domain.length * h->elementSize);
+    return true;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+SortedIndex* SortedIndex::load(Field* f, const String& indexPath, const String& source)
+{
+    Header expected;
+    if(!makeHeader(f, source, &expected)) return NULL;
+
+    FILE* fin = fopen(indexPath.c_str(), "rb");
+    if(fin == NULL) return NULL;
+
+    // Discard indices built for a different version of the source.
+    Header h;
+    if(fread(&h, sizeof(Header), 1, fin) != 1 ||
+        memcmp(&h, &expected, sizeof(Header)) != 0)
+    {
+        fclose(fin);
+        return NULL;
+    }
+
+    size_t n = (size_t)h.numElements;
+    size_t numValid = 0;
+    Vector<uint> order(n);
+    Vector<char> values(n * h.elementSize);
+    bool ok = fread(&numValid, sizeof(size_t), 1, fin) == 1;
+    if(n > 0)
+    {
+        ok &= fread(&order[0], sizeof(uint), n, fin) == n;
+        ok &= fread(&values[0], h.elementSize, n, fin) == n;
+    }
+    fclose(fin);
+    if(!ok)
+    {
+        ofwarn("[SortedIndex::load] failed reading <%1%>", %indexPath);
+        return NULL;
+    }
+
+    SortedIndex* idx = new SortedIndex(h.elementSize, f->version);
+    idx->myNumValid = numValid;
+    idx->myOrder.swap(order);
+    idx->myValues.swap(values);
+    return idx;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+void SortedIndex::save(Field* f, const String& indexPath, const String& source)
+{
+    Header h;
+    if(!makeHeader(f, source, &h)) return;
+
+    // Write to a temporary file first, so a partially written index is never
+    // picked up.
+    String tmpPath = indexPath + ".tmp";
+    FILE* fout = fopen(tmpPath.c_str(), "wb");
+    if(fout == NULL)
+    {
+        ofwarn("[SortedIndex::save] failed opening <%1%> for writing", %tmpPath);
+        return;
+    }
+    size_t n = myOrder.size();
+    bool ok = fwrite(&h, sizeof(Header), 1, fout) == 1;
+    ok &= fwrite(&myNumValid, sizeof(size_t), 1, fout) == 1;
+    if(n > 0)
+    {
+        ok &= fwrite(&myOrder[0], sizeof(uint), n, fout) == n;
+        ok &= fwrite(&myValues[0], myElementSize, n, fout) == n;
+    }
+    fclose(fout);
+
+    remove(indexPath.c_str());
+    if(!ok || rename(tmpPath.c_str(), indexPath.c_str()) != 0)
+    {
+        ofwarn("[SortedIndex::save] failed writing <%1%>", %indexPath);
+        remove(tmpPath.c_str());
+    }
+}
+
+///////////////////////////////////////////////////////////////////////////////
+template<typename T>
+void SortedIndex::findRange(float vmin, float vmax, size_t* first, size_t* last)
+{
+    const T* values = myValues.empty() ? NULL : (const T*)&myValues[0];
+    // Same comparisons as the filter: v passes if !(v < vmin) && !(v > vmax)
+    *first = std::lower_bound(values, values + myNumValid, vmin) - values;
+    *last = std::upper_bound(values, values + myNumValid, vmax) - values;
+    if(*last < *first) *last = *first;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+void SortedIndex::findRange(float vmin, float vmax, size_t* first, size_t* last)
+{
+    if(myElementSize == sizeof(double)) findRange<double>(vmin, vmax, first, last);
+    else findRange<float>(vmin, vmax, first, last);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+void SortedIndexTask::execute(WorkerTask::TaskInfo* ti)
+{
+    Field* f = myField;
+
+    // Keep the field data in memory while the index is built.
+    f->pin();
+    f->lock.lock();
+    bool loaded = f->loaded && f->data != NULL;
+    f->lock.unlock();
+    if(!loaded || f->getSortedIndex() != NULL)
+    {
+        f->unpin();
+        return;
+    }
+
+    // Fields read from files cache their index next to the source file.
+    // Decimated loads pick random records, so their data differs from load
+    // to load and their index is never cached.
+    String path;
+    Loader* loader = f->getDimension()->dataset->getLoader();
+    bool cached = f->domain.decimation <= 1 &&
+        loader != NULL && !loader->getSource().empty() &&
+        DataManager::findFile(loader->getSource(), path);
+    String indexPath = ostr("%1%.%2%.%3%-%4%-%5%.sidx", 
+        %path %f->getDimension()->id %f->domain.start %f->domain.length %f->domain.decimation);
+
+    double t = otimestamp();
+    Ref<SortedIndex> idx;
+    if(cached) idx = SortedIndex::load(f, indexPath, path);
+    if(idx == NULL)
+    {
+        idx = SortedIndex::build(f);
+        oflog(Verbose, "[SortedIndexTask] indexed %1% in %2% seconds", 
+            %f->getName() %(otimestamp() - t));
+        if(cached) idx->save(f, indexPath, path);
+    }
+    f->setSortedIndex(idx);
+    f->unpin();
+}
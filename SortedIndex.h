@@ -0,0 +1,93 @@
+#ifndef __SORTED_INDEX__
+#define __SORTED_INDEX__
+
+#include <omega.h>
+
+using namespace omega;
+
+class Field;
+
+///////////////////////////////////////////////////////////////////////////////
+//! Secondary index of a field: the element indices sorted by value (the
+//! argsort permutation) and the sorted values. The elements with values in a
+//! range are found with two binary searches on the sorted values. NaN values
+//! sort last, and are not part of any range.
+//! The index is built with a parallel sort on the compute pool. Indices of
+//! fields that are not decimated can be saved to an index file next to the
+//! data source, so later loads of the same field read them back instead of
+//! sorting again. Index files store a checksum of the field data, and are
+//! only used for identical data.
+class SortedIndex : public ReferenceType
+{
+public:
+    //! Builds the index of the field data. The field must stay loaded (and
+    //! pinned) during the build.
+    static SortedIndex* build(Field* f);
+    //! Reads the index of f from indexPath. Returns NULL if the file does not
+    //! exist, or was built for a different version of the source file.
+    static SortedIndex* load(Field* f, const String& indexPath, const String& source);
+    //! Saves the index of f, read from the source file.
+    void save(Field* f, const String& indexPath, const String& source);
+
+    //! Field version the index was built for.
+    uint getVersion() { return myVersion; }
+
+    size_t getNumElements() { return myOrder.size(); }
+    //! Number of elements that are not NaN. NaN elements are at the end of
+    //! the permutation, in positions [getNumValid(), getNumElements()).
+    size_t getNumValid() { return myNumValid; }
+    //! Element indices in value order.
+    const uint* getOrder() { return myOrder.empty() ? NULL : &myOrder[0]; }
+
+    //! Finds the positions [first, last) of the permutation holding the
+    //! elements with values in [vmin, vmax].
+    void findRange(float vmin, float vmax, size_t* first, size_t* last);
+
+    size_t getMemorySize() { return myOrder.size() * (sizeof(uint) + myElementSize); }
+
+private:
+    struct Header
+    {
+        uint magic;
+        uint version;
+        uint elementSize;
+        uint decimation;
+        uint64_t numElements;
+        uint64_t sourceSize;
+        uint64_t sourceTime;
+        uint64_t domainStart;
+        uint64_t domainLength;
+        // Checksum of the field data the index was built for.
+        uint64_t dataChecksum;
+    };
+
+    SortedIndex(size_t elementSize, uint version);
+
+    static bool makeHeader(Field* f, const String& source, Header* h);
+    static uint64_t checksum(const char* data, size_t size);
+    template<typename T> void sort(const T* data, size_t n);
+    template<typename T> void findRange(float vmin, float vmax, size_t* first, size_t* last);
+
+private:
+    size_t myElementSize;
+    uint myVersion;
+    size_t myNumValid;
+    Vector<uint> myOrder;
+    // Sorted values, of the field element type.
+    Vector<char> myValues;
+};
+
+///////////////////////////////////////////////////////////////////////////////
+//! Worker task that loads or builds the sorted index of a field after the
+//! field finished loading.
+class SortedIndexTask : public WorkerTask
+{
+public:
+    SortedIndexTask(Field* f) : myField(f) {}
+    void execute(WorkerTask::TaskInfo* ti);
+
+private:
+    Ref<Field> myField;
+};
+
+#endif
@@ -0,0 +1,67 @@
+#include "UploadPolicy.h"
+
+///////////////////////////////////////////////////////////////////////////////
+UploadPolicy::UploadPolicy():
+    myCapacity(0),
+    mySize(0),
+    myVersion(0),
+    myUploadedBytes(0)
+{
+}
+
+///////////////////////////////////////////////////////////////////////////////
+void UploadPolicy::reset()
+{
+    myCapacity = 0;
+    mySize = 0;
+    myVersion = 0;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+size_t UploadPolicy::getUpdateSize(size_t size, uint version, uint rewriteVersion,
+    const Vector<DirtyRange>& ranges)
+{
+    if(isValid() && myVersion == version) return 0;
+    if(!isValid() || myVersion < rewriteVersion || size > myCapacity) return size;
+
+    size_t bytes = 0;
+    foreach(const DirtyRange& r, ranges)
+    {
+        if(r.version <= myVersion || r.offset >= size) continue;
+        bytes += min(r.size, size - r.offset);
+    }
+    return bytes;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+void UploadPolicy::update(UploadTarget* target, const char* data, size_t size,
+    uint version, uint rewriteVersion, const Vector<DirtyRange>& ranges)
+{
+    if(isValid() && myVersion == version) return;
+
+    bool full = !isValid() || myVersion < rewriteVersion;
+    if(full || size > myCapacity)
+    {
+        // Upload everything. When growing, at least double the capacity so
+        // the next blocks of a growing field fit in the target.
+        size_t capacity = size;
+        if(!full && capacity < myCapacity * 2) capacity = myCapacity * 2;
+        if(capacity == 0) return;
+        if(!target->allocate(capacity, data, size)) return;
+        myCapacity = capacity;
+        myUploadedBytes += size;
+    }
+    else
+    {
+        // Upload ranges modified after our version.
+        foreach(const DirtyRange& r, ranges)
+        {
+            if(r.version <= myVersion || r.offset >= size) continue;
+            size_t sz = min(r.size, size - r.offset);
+            if(!target->upload(r.offset, sz, data + r.offset)) return;
+            myUploadedBytes += sz;
+        }
+    }
+    mySize = size;
+    myVersion = version;
+}
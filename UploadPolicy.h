@@ -0,0 +1,70 @@
+#ifndef __UPLOAD_POLICY__
+#define __UPLOAD_POLICY__
+
+#include <omega.h>
+
+using namespace omega;
+
+///////////////////////////////////////////////////////////////////////////////
+//! Destination of field data uploads. Field::getGpuBuffer implements it over
+//! a GpuBuffer.
+class UploadTarget
+{
+public:
+    virtual ~UploadTarget() {}
+    //! (Re)creates the target storage with the given capacity, and fills its
+    //! first size bytes with data. Previous content is lost.
+    virtual bool allocate(size_t capacity, const void* data, size_t size) = 0;
+    //! Writes size bytes of data at offset.
+    virtual bool upload(size_t offset, size_t size, const void* data) = 0;
+};
+
+///////////////////////////////////////////////////////////////////////////////
+//! A byte range of field data modified at a given field version.
+struct DirtyRange
+{
+    size_t offset;
+    size_t size;
+    uint version;
+};
+
+///////////////////////////////////////////////////////////////////////////////
+//! Keeps an upload target in sync with field data, uploading only the byte
+//! ranges that changed since the last update. Target capacity grows 
+//! geometrically, so fields that grow block by block are uploaded in 
+//! amortized linear time.
+//! One UploadPolicy is used for each target (i.e. for each gpu context).
+class UploadPolicy
+{
+public:
+    UploadPolicy();
+
+    //! Updates target with the current field data.
+    //! version is the current field version. rewriteVersion is the version at
+    //! which the data was last replaced as a whole: targets older than it are
+    //! uploaded from scratch. ranges are the ranges modified since then.
+    void update(UploadTarget* target, const char* data, size_t size,
+        uint version, uint rewriteVersion, const Vector<DirtyRange>& ranges);
+
+    //! Returns the number of bytes the next update would upload.
+    size_t getUpdateSize(size_t size, uint version, uint rewriteVersion,
+        const Vector<DirtyRange>& ranges);
+
+    //! Forgets the target state. The next update uploads all the data.
+    void reset();
+
+    bool isValid() { return myCapacity != 0; }
+    uint getVersion() { return myVersion; }
+    size_t getCapacity() { return myCapacity; }
+    size_t getSize() { return mySize; }
+    //! Total number of bytes sent to the target.
+    size_t getUploadedBytes() { return myUploadedBytes; }
+
+private:
+    size_t myCapacity;
+    size_t mySize;
+    uint myVersion;
+    size_t myUploadedBytes;
+};
+
+#endif
@@ -0,0 +1,115 @@
+#include "UploadScheduler.h"
+
+// Default upload budget per frame and gpu context.
+#define DEFAULT_UPLOAD_BUDGET (16 * 1024 * 1024)
+
+UploadScheduler* UploadScheduler::mysInstance = NULL;
+
+///////////////////////////////////////////////////////////////////////////////
+UploadScheduler* UploadScheduler::instance()
+{
+    if(mysInstance == NULL) mysInstance = new UploadScheduler();
+    return mysInstance;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+UploadScheduler::UploadScheduler():
+    myBudget(DEFAULT_UPLOAD_BUDGET)
+{
+}
+
+///////////////////////////////////////////////////////////////////////////////
+void UploadScheduler::setBudget(size_t bytes)
+{
+    AutoLock al(myLock);
+    myBudget = bytes;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+void UploadScheduler::beginFrame(ContextState& cs, uint64_t frame)
+{
+    cs.frame = frame;
+    cs.used = 0;
+    cs.reserved = 0;
+    cs.granted.clear();
+
+    // Reserve budget for the uploads deferred last frame, most important
+    // first. Priorities may have changed since the uploads were deferred.
+    double now = otimestamp();
+    foreach(Request& r, cs.deferred) r.priority = r.field->getEffectivePriority(now);
+    std::sort(cs.deferred.begin(), cs.deferred.end());
+    cs.pendingBytes = 0;
+    foreach(const Request& r, cs.deferred)
+    {
+        cs.pendingBytes += r.size;
+        // Always grant the first upload, even if it is larger than the 
+        // budget, or it would never happen.
+        if(cs.reserved + r.size <= myBudget || cs.granted.empty())
+        {
+            cs.granted.push_back(r);
+            cs.reserved += r.size;
+        }
+    }
+    cs.deferred.clear();
+    cs.deferredIndex.clear();
+}
+
+///////////////////////////////////////////////////////////////////////////////
+bool UploadScheduler::requestUpload(const DrawContext& dc, Field* f, size_t size)
+{
+    AutoLock al(myLock);
+    if(myBudget == 0) return true;
+
+    uint ctx = dc.gpuContext->getId();
+    if(ctx >= myContexts.size()) myContexts.resize(ctx + 1);
+    ContextState& cs = myContexts[ctx];
+    if(cs.frame != dc.frameNum) beginFrame(cs, dc.frameNum);
+
+    // Uploads granted at the start of the frame use their reserved budget.
+    for(Vector<Request>::iterator it = cs.granted.begin(); it != cs.granted.end(); it++)
+    {
+        if(it->field == f)
+        {
+            cs.reserved -= it->size;
+            cs.used += size;
+            cs.granted.erase(it);
+            return true;
+        }
+    }
+
+    // Other uploads use what is left of the budget.
+    if(cs.used + cs.reserved + size <= myBudget)
+    {
+        cs.used += size;
+        return true;
+    }
+
+    // Fields already deferred this frame get their size and priority 
+    // refreshed.
+    float priority = f->getEffectivePriority(otimestamp());
+    std::map<Field*, size_t>::iterator it = cs.deferredIndex.find(f);
+    if(it != cs.deferredIndex.end())
+    {
+        Request& r = cs.deferred[it->second];
+        r.size = size;
+        r.priority = priority;
+        return false;
+    }
+
+    Request r;
+    r.field = f;
+    r.size = size;
+    r.priority = priority;
+    cs.deferredIndex[f] = cs.deferred.size();
+    cs.deferred.push_back(r);
+    return false;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+size_t UploadScheduler::getPendingBytes()
+{
+    AutoLock al(myLock);
+    size_t bytes = 0;
+    foreach(const ContextState& cs, myContexts) bytes += cs.pendingBytes;
+    return bytes;
+}
@@ -0,0 +1,80 @@
+#ifndef __UPLOAD_SCHEDULER__
+#define __UPLOAD_SCHEDULER__
+
+#include <omega.h>
+#include "Dataset.h"
+
+#include <map>
+
+using namespace omega;
+
+///////////////////////////////////////////////////////////////////////////////
+//! Limits the field data uploaded to each gpu context in a frame. Uploads 
+//! that do not fit the frame budget are deferred: at the start of the next
+//! frame, budget is reserved for deferred uploads in order of field priority,
+//! so streamed data is spread over several frames without starving the most
+//! important fields. Priorities are read again when budget is reserved, so
+//! fields that became more important while waiting move ahead.
+class UploadScheduler
+{
+public:
+    static UploadScheduler* instance();
+
+    //! Sets the upload budget in bytes per frame and per gpu context. 0 means
+    //! no limit.
+    void setBudget(size_t bytes);
+    size_t getBudget() { return myBudget; }
+
+    //! Asks to upload size bytes of field f in the current frame. Returns
+    //! false if the upload has to wait for a later frame.
+    bool requestUpload(const DrawContext& dc, Field* f, size_t size);
+
+    //! Returns the bytes of uploads that were waiting for budget at the start
+    //! of the current frame, summed over all gpu contexts.
+    size_t getPendingBytes();
+
+private:
+    struct Request
+    {
+        Ref<Field> field;
+        size_t size;
+        float priority;
+
+        bool operator<(const Request& rhs) const
+        {
+            return priority > rhs.priority;
+        }
+    };
+
+    // Upload state of a gpu context
+    struct ContextState
+    {
+        ContextState(): frame(0), used(0), reserved(0), pendingBytes(0) {}
+
+        uint64_t frame;
+        // Bytes uploaded in the current frame.
+        size_t used;
+        // Bytes reserved for granted uploads that did not happen yet.
+        size_t reserved;
+        // Uploads granted budget this frame.
+        Vector<Request> granted;
+        // Uploads deferred this frame, and their index in deferred by field.
+        // Fields drawn several times in a frame are deferred once.
+        Vector<Request> deferred;
+        std::map<Field*, size_t> deferredIndex;
+        // Bytes deferred in the last frame.
+        size_t pendingBytes;
+    };
+
+    UploadScheduler();
+    void beginFrame(ContextState& cs, uint64_t frame);
+
+private:
+    static UploadScheduler* mysInstance;
+
+    Lock myLock;
+    size_t myBudget;
+    Vector<ContextState> myContexts;
+};
+
+#endif
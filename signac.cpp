@@ -5,12 +5,19 @@
 #include "CsvLoader.h"
 #include "BinaryLoader.h"
 #include "Dataset.h"
+#include "DatasetFilter.h"
+#include "Crossfilter.h"
+#include "FilterEstimator.h"
 #include "Hdf5Loader.h"
 #include "NumpyLoader.h"
 #include "FireLoader.h"
 #include "Scatterplot.h"
 #include "PointCloud.h"
 #include "PointCloudView.h"
+#include "FieldCache.h"
+#include "FilterCache.h"
+#include "UploadScheduler.h"
+#include "ComputePool.h"
 
 using namespace omega;
 
@@ -27,6 +34,9 @@ public:
 
     void render(Renderer* client, const DrawContext& context)
     {
+        // Free the gpu memory of fields evicted from the field cache.
+        FieldCache::instance()->releaseGpuBuffers(context);
+
         foreach(Program* p, Signac::instance->getPrograms())
         {
             p->prepare(context);
@@ -79,6 +89,8 @@ void Signac::dispose()
 ///////////////////////////////////////////////////////////////////////////////
 void Signac::update(const UpdateContext& context)
 {
+    FieldCache::instance()->beginFrame();
+
     foreach(Plot* p, plots)
     {
         p->update();
@@ -135,14 +147,44 @@ void Signac::signalFieldLoaded(Field* f)
 }
 
 ///////////////////////////////////////////////////////////////////////////////
-void Signac::addTask(WorkerTask* task)
+void Signac::setMemoryBudget(int megabytes)
+{
+    FieldCache::instance()->setBudget((size_t)megabytes * 1024 * 1024);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+void Signac::setFilterCacheBudget(int megabytes)
+{
+    FilterCache::instance()->setBudget((size_t)megabytes * 1024 * 1024);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+void Signac::setComputeThreads(int threads)
+{
+    ComputePool::instance()->setThreads(threads);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+void Signac::setUploadBudget(int megabytes)
+{
+    UploadScheduler::instance()->setBudget((size_t)megabytes * 1024 * 1024);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+size_t Signac::getPendingUploadBytes()
+{
+    return UploadScheduler::instance()->getPendingBytes();
+}
+
+///////////////////////////////////////////////////////////////////////////////
+void Signac::addTask(WorkerTask* task, Field* f)
 {
     if(myWorkers.isNull())
     {
-        myWorkers = new WorkerPool();
+        myWorkers = new LoadScheduler();
         myWorkers->start(myWorkerThreads);
     }
-    myWorkers->queue(task);
+    myWorkers->queue(task, f);
 }
 
 
@@ -159,6 +201,7 @@ BOOST_PYTHON_MODULE(signac)
         PYAPI_PROPERTY(Dimension, label)
         PYAPI_PROPERTY(Dimension, floatRangeMax)
         PYAPI_PROPERTY(Dimension, floatRangeMin)
+        PYAPI_PROPERTY(Dimension, sortedIndex)
         ;
 
     PYAPI_REF_BASE_CLASS(Field)
@@ -200,6 +243,45 @@ BOOST_PYTHON_MODULE(signac)
         PYAPI_METHOD(Filter, setField)
         PYAPI_METHOD(Filter, setRange)
         PYAPI_METHOD(Filter, setNormalizedRange)
+        PYAPI_METHOD(Filter, setAnd)
+        PYAPI_METHOD(Filter, setOr)
+        PYAPI_METHOD(Filter, setNot)
+        PYAPI_METHOD(Filter, getFilteredLength)
+        PYAPI_METHOD(Filter, hasSelection)
+        PYAPI_METHOD(Filter, setProgressInterval)
+        ;
+
+    PYAPI_REF_BASE_CLASS_WITH_CTOR(FilterEstimator)
+        PYAPI_METHOD(FilterEstimator, setFilter)
+        PYAPI_METHOD(FilterEstimator, setSample)
+        PYAPI_METHOD(FilterEstimator, setHistogram)
+        PYAPI_METHOD(FilterEstimator, update)
+        PYAPI_METHOD(FilterEstimator, getSampleSize)
+        PYAPI_METHOD(FilterEstimator, getCount)
+        PYAPI_METHOD(FilterEstimator, getCountLow)
+        PYAPI_METHOD(FilterEstimator, getCountHigh)
+        PYAPI_METHOD(FilterEstimator, getNumBins)
+        PYAPI_METHOD(FilterEstimator, getBinCount)
+        PYAPI_METHOD(FilterEstimator, getBinLow)
+        PYAPI_METHOD(FilterEstimator, getBinHigh)
+        ;
+
+    PYAPI_REF_BASE_CLASS_WITH_CTOR(DatasetFilter)
+        PYAPI_METHOD(DatasetFilter, setDimension)
+        PYAPI_METHOD(DatasetFilter, setRange)
+        PYAPI_METHOD(DatasetFilter, setNormalizedRange)
+        ;
+
+    PYAPI_REF_BASE_CLASS_WITH_CTOR(Crossfilter)
+        PYAPI_METHOD(Crossfilter, addDimension)
+        PYAPI_METHOD(Crossfilter, setRange)
+        PYAPI_METHOD(Crossfilter, setNormalizedRange)
+        PYAPI_METHOD(Crossfilter, clearRange)
+        PYAPI_METHOD(Crossfilter, getNumBins)
+        PYAPI_METHOD(Crossfilter, getCount)
+        PYAPI_METHOD(Crossfilter, getSelectedCount)
+        PYAPI_METHOD(Crossfilter, getStamp)
+        PYAPI_METHOD(Crossfilter, isReady)
         ;
 
     PYAPI_REF_BASE_CLASS(PlotBrush)
@@ -243,6 +325,9 @@ BOOST_PYTHON_MODULE(signac)
         PYAPI_STATIC_REF_GETTER(PointCloud, create)
         PYAPI_METHOD(PointCloud, setOptions)
         PYAPI_METHOD(PointCloud, setDimensions)
+        PYAPI_METHOD(PointCloud, getSetupProgress)
+        PYAPI_METHOD(PointCloud, isReady)
+        PYAPI_METHOD(PointCloud, setReadyCommand)
         PYAPI_METHOD(PointCloud, setData)
         PYAPI_METHOD(PointCloud, setVectorData)
         PYAPI_REF_GETTER(PointCloud, getDataX)
@@ -250,6 +335,7 @@ BOOST_PYTHON_MODULE(signac)
         PYAPI_REF_GETTER(PointCloud, getDataZ)
         PYAPI_METHOD(PointCloud, setSize)
         PYAPI_METHOD(PointCloud, setFilter)
+        PYAPI_METHOD(PointCloud, setSelection)
         PYAPI_METHOD(PointCloud, setFilterBounds)
         PYAPI_METHOD(PointCloud, normalizeFilterBounds)
         PYAPI_METHOD(PointCloud, setProgram)
@@ -258,6 +344,7 @@ BOOST_PYTHON_MODULE(signac)
         PYAPI_METHOD(PointCloud, setColor)
         PYAPI_METHOD(PointCloud, setDecimation)
         PYAPI_METHOD(PointCloud, setFocusPosition)
+        PYAPI_METHOD(PointCloud, setPrefetch)
         PYAPI_METHOD(PointCloud, setVisible)
         PYAPI_REF_GETTER(PointCloud, getColormap)
         PYAPI_REF_GETTER(PointCloud, getProgram)
@@ -279,6 +366,11 @@ BOOST_PYTHON_MODULE(signac)
         PYAPI_REF_GETTER(Signac, addProgram)
         PYAPI_METHOD(Signac, setFieldLoadedCommand)
         PYAPI_METHOD(Signac, setWorkerThreads)
+        PYAPI_METHOD(Signac, setComputeThreads)
+        PYAPI_METHOD(Signac, setMemoryBudget)
+        PYAPI_METHOD(Signac, setFilterCacheBudget)
+        PYAPI_METHOD(Signac, setUploadBudget)
+        PYAPI_METHOD(Signac, getPendingUploadBytes)
         ;
 
     Signac::instance = new Signac();
@@ -4,6 +4,7 @@
 #include <omega.h>
 #include "PointCloud.h"
 #include "Program.h"
+#include "LoadScheduler.h"
 using namespace omega;
 
 class PointCloudView;
@@ -33,8 +34,25 @@ public:
     void setFieldLoadedCommand(const String& cmd) { myFieldLoadedCommand = cmd; }
     void signalFieldLoaded(Field* f);
 
-    void addTask(WorkerTask* task);
+    //! Queues a task on the signac worker threads. If the task loads a field,
+    //! pass it as f so the task is scheduled by field priority.
+    void addTask(WorkerTask* task, Field* f = NULL);
     void setWorkerThreads(int th) { myWorkerThreads = th; }
+    //! Sets the number of threads used by filters. Defaults to the number of
+    //! cpu cores.
+    void setComputeThreads(int threads);
+    //! Sets the host memory budget for loaded field data, in megabytes. When
+    //! the budget is exceeded the least recently used fields are freed.
+    //! 0 (the default) means no limit.
+    void setMemoryBudget(int megabytes);
+    //! Sets the memory budget of cached filter results, in megabytes. 0
+    //! disables the cache.
+    void setFilterCacheBudget(int megabytes);
+    //! Sets the maximum amount of field data uploaded to the gpu in a frame,
+    //! in megabytes. 0 means no limit.
+    void setUploadBudget(int megabytes);
+    //! Returns the bytes of field data waiting for upload budget.
+    size_t getPendingUploadBytes();
 
 protected:
     void addPointCloudView(PointCloudView* pc);
@@ -46,7 +64,7 @@ private:
     Lock myLock;
     String myFieldLoadedCommand;
     int myWorkerThreads;
-    Ref<WorkerPool> myWorkers;
+    Ref<LoadScheduler> myWorkers;
 };
 
 #endif
\ No newline at end of file